@@ -0,0 +1,161 @@
+# Decodes the binary log that MP1-Boot records when BinaryLogMessages is set
+# (see src/print_messages.hh and src/binary_log.hh).
+#
+# Usage: python3 binlog_decode.py build/fsbl.elf [binlog.bin]
+#   With only the ELF file, prints where the log region is and how to dump it.
+#   binlog.bin is a dump of the region from memory, for example with gdb:
+#     dump binary memory binlog.bin 0x2FFCxxxx 0x2FFCxxxx
+#
+# The ELF file must be the one that recorded the log: strings in the FSBL's .rodata
+# are recorded as pointers, and are read back from the ELF file. Other strings are
+# copied into the log.
+
+import re
+import struct
+import sys
+
+MAGIC = 0x474F4C42
+REGION_SYMBOL = "_ZN9BinaryLog6regionE"
+
+STRING, INT, UNSIGNED, HEX, INT64, UNSIGNED64, COPIED_STRING = range(7)
+
+SHT_PROGBITS = 1
+SHT_SYMTAB = 2
+SHF_ALLOC = 2
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            sys.exit(f"{path}: not a 32-bit ELF file")
+
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            name, type, flags, addr, offset, size, link = struct.unpack_from("<IIIIIII", self.data, shoff + i * shentsize)
+            self.sections.append(dict(name=name, type=type, flags=flags, addr=addr, offset=offset, size=size, link=link))
+
+    def string_at(self, addr):
+        for s in self.sections:
+            if s["type"] == SHT_PROGBITS and s["flags"] & SHF_ALLOC and s["addr"] <= addr < s["addr"] + s["size"]:
+                start = s["offset"] + addr - s["addr"]
+                end = self.data.index(b"\0", start)
+                return self.data[start:end].decode("latin-1")
+        return None
+
+    def symbol(self, wanted):
+        for s in self.sections:
+            if s["type"] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[s["link"]]
+            for off in range(s["offset"], s["offset"] + s["size"], 16):
+                name, value, size = struct.unpack_from("<III", self.data, off)
+                start = strtab["offset"] + name
+                if self.data[start:self.data.index(b"\0", start)].decode() == wanted:
+                    return value, size
+        return None
+
+
+class Hex(int):
+    """A Hex{} argument: printed like print() does, unless a format spec says otherwise"""
+
+    def __str__(self):
+        return f"{int(self):X}"
+
+
+def read_args(words, pos, header, elf):
+    args = []
+    for i in range(header & 0x1F):
+        type = (header >> (5 + 3 * i)) & 0x7
+        if type == COPIED_STRING:
+            length = words[pos]
+            num_words = (length + 3) // 4
+            chars = struct.pack(f"<{num_words}I", *words[pos + 1:pos + 1 + num_words])
+            args.append(chars[:length].decode("latin-1"))
+            pos += 1 + num_words
+            continue
+
+        if type in (INT64, UNSIGNED64):
+            value = words[pos] | (words[pos + 1] << 32)
+            pos += 2
+            if type == INT64 and value >= 1 << 63:
+                value -= 1 << 64
+        else:
+            value = words[pos]
+            pos += 1
+            if type == INT and value >= 1 << 31:
+                value -= 1 << 32
+
+        if type == STRING:
+            string = elf.string_at(value)
+            args.append(string if string is not None else f"<string at 0x{value:08X}>")
+        elif type == HEX:
+            args.append(Hex(value))
+        else:
+            args.append(value)
+    return args, pos
+
+
+# Some older messages use printf-style format strings
+FORMAT_SPEC = re.compile(r"%([-0]?\d*)(?:ll|l|hh|h|z)?([diuxXcsp%])")
+
+
+def format_message(args):
+    if args and isinstance(args[0], str) and FORMAT_SPEC.search(args[0]):
+        rest = iter(args[1:])
+
+        def convert(m):
+            if m.group(2) == "%":
+                return "%"
+            value = next(rest, "?")
+            conv = {"i": "d", "u": "d", "p": "x", "c": "c"}.get(m.group(2), m.group(2))
+            if conv == "s" or isinstance(value, str):
+                return str(value)
+            return ("%" + m.group(1) + conv) % int(value)
+
+        return FORMAT_SPEC.sub(convert, args[0]) + "".join(str(a) for a in rest)
+
+    return "".join(str(a) for a in args)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("Usage: python3 binlog_decode.py fsbl.elf [binlog.bin]")
+
+    elf = Elf(sys.argv[1])
+
+    if len(sys.argv) < 3:
+        sym = elf.symbol(REGION_SYMBOL)
+        if not sym:
+            sys.exit("No binary log region in this ELF file (is BinaryLogMessages set?)")
+        addr, size = sym
+        print(f"Binary log region: 0x{addr:08X}, {size} bytes")
+        print(f"gdb: dump binary memory binlog.bin 0x{addr:08X} 0x{addr + size:08X}")
+        return
+
+    with open(sys.argv[2], "rb") as f:
+        dump = f.read()
+
+    start = dump.find(struct.pack("<I", MAGIC))
+    if start < 0:
+        sys.exit("No binary log found in the dump")
+
+    size_words, used_words, dropped = struct.unpack_from("<III", dump, start + 4)
+    used_words = min(used_words, size_words, (len(dump) - start - 16) // 4)
+    words = struct.unpack_from(f"<{used_words}I", dump, start + 16)
+
+    pos = 0
+    while pos < used_words:
+        header = words[pos]
+        args, pos = read_args(words, pos + 1, header, elf)
+        sys.stdout.write(format_message(args))
+
+    if dropped:
+        print(f"\n[{dropped} entries dropped: log region full]")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,69 @@
+# Makes an LZ4-compressed legacy U-Boot image (uImage) that MP1-Boot can load.
+#
+# MP1-Boot loads the compressed image to the top of RAM and decompresses it
+# to the load address while it's being read from the boot media.
+#
+# Usage: python3 mkimage_lz4.py app.bin app.uimg 0xC2000040 [name]
+#   The load address is also the entry point.
+#
+# Requires either the lz4 python module (pip install lz4) or the lz4 command.
+
+import struct
+import subprocess
+import sys
+import time
+import zlib
+
+IH_MAGIC = 0x27051956
+IH_OS_U_BOOT = 17
+IH_ARCH_ARM = 2
+IH_TYPE_FIRMWARE = 5
+IH_COMP_LZ4 = 5
+
+
+def lz4_compress(data):
+    # 64kB linked blocks: keeps each block quick to decompress while the next one loads
+    try:
+        import lz4.frame
+        return lz4.frame.compress(data,
+                                  block_size=lz4.frame.BLOCKSIZE_MAX64KB,
+                                  block_linked=True,
+                                  compression_level=lz4.frame.COMPRESSIONLEVEL_MINHC)
+    except ImportError:
+        return subprocess.run(["lz4", "-9", "-B4", "-BD", "-c"], input=data, capture_output=True, check=True).stdout
+
+
+def make_header(data, load_addr, name, timestamp, hcrc=0):
+    return struct.pack(">IIIIIIIBBBB32s",
+                       IH_MAGIC,
+                       hcrc,
+                       timestamp,
+                       len(data),
+                       load_addr,
+                       load_addr,
+                       zlib.crc32(data),
+                       IH_OS_U_BOOT,
+                       IH_ARCH_ARM,
+                       IH_TYPE_FIRMWARE,
+                       IH_COMP_LZ4,
+                       name.encode("ascii")[:32])
+
+
+with open(sys.argv[1], "rb") as bin_file:
+    image = bin_file.read()
+
+load_addr = int(sys.argv[3], 0)
+name = sys.argv[4] if len(sys.argv) > 4 else "lz4 image"
+
+data = lz4_compress(image)
+
+# The header CRC is calculated with the ih_hcrc field set to 0
+timestamp = int(time.time())
+header = make_header(data, load_addr, name, timestamp)
+header = make_header(data, load_addr, name, timestamp, zlib.crc32(header))
+
+with open(sys.argv[2], "wb") as out_file:
+    out_file.write(header)
+    out_file.write(data)
+
+print(f"{sys.argv[2]}: {len(image)} bytes compressed to {len(data)} bytes")
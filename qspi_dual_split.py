@@ -0,0 +1,25 @@
+# Splits an image for QSPI dual-flash mode.
+#
+# In dual-flash mode the QUADSPI reads both chips in parallel: flash 1 holds
+# the even bytes and flash 2 the odd bytes. Program each half at the same
+# address you'd use for the whole image with a single chip (for example
+# 0x80000 for the app): MP1-Boot reads it from twice that offset in the
+# memory-mapped window.
+#
+# Usage: python3 qspi_dual_split.py image.uimg
+#   writes image.uimg.flash1 and image.uimg.flash2
+
+import sys
+
+with open(sys.argv[1], "rb") as image_file:
+    image = image_file.read()
+
+# Pad to an even size so both halves are the same length
+if len(image) % 2:
+    image += b"\xFF"
+
+with open(sys.argv[1] + ".flash1", "wb") as flash1:
+    flash1.write(image[0::2])
+
+with open(sys.argv[1] + ".flash2", "wb") as flash2:
+    flash2.write(image[1::2])
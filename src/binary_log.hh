@@ -0,0 +1,154 @@
+#pragma once
+#include "print.hh"
+#include <cstdint>
+#include <type_traits>
+
+extern "C" const char _rodata_start[];
+extern "C" const char _rodata_end[];
+
+// Records log messages in binary, instead of formatting and printing them.
+// Each entry is a header word with the number of arguments and their types,
+// followed by the raw arguments. Strings in the FSBL's .rodata (string literals)
+// are recorded as pointers, and binlog_decode.py reads them from the ELF file.
+// Other strings (on the stack, or read from boot media) are copied into the entry:
+// a word with the length, then the characters (up to MaxStringChars).
+// The region is in SYSRAM, which is not touched by jumping to the app, so it can be
+// read afterwards (by the app or with a debugger). When it's full, entries are dropped.
+struct BinaryLog {
+	static constexpr uint32_t Magic = 0x474F4C42; // "BLOG"
+	static constexpr uint32_t SizeWords = 4096;
+	static constexpr uint32_t MaxArgs = 9;
+	static constexpr uint32_t MaxStringChars = 64;
+
+	// Argument types, 3 bits each in the header
+	enum ArgType : uint32_t {
+		String = 0,
+		Int = 1,
+		Unsigned = 2,
+		HexValue = 3,
+		Int64 = 4,
+		Unsigned64 = 5,
+		CopiedString = 6,
+	};
+
+	struct Region {
+		uint32_t magic;
+		uint32_t size_words; // capacity of data[]
+		uint32_t used_words;
+		uint32_t dropped; // entries that didn't fit
+		uint32_t data[SizeWords];
+	};
+
+	// Zero-initialized (in .bss), so it doesn't take space in the FSBL image
+	static inline Region region;
+
+	template<typename... Types>
+	static void record(Types... args)
+	{
+		static_assert(sizeof...(args) <= MaxArgs, "Too many arguments for a binary log entry");
+
+		if (region.magic != Magic) {
+			region.magic = Magic;
+			region.size_words = SizeWords;
+		}
+
+		// Whether strings are copied is only known at run time
+		const uint32_t num_words = 1 + (words_for(args) + ... + 0);
+		if (region.used_words + num_words > SizeWords) {
+			region.dropped++;
+			return;
+		}
+
+		uint32_t header = sizeof...(args);
+		uint32_t shift = 5;
+		((header |= static_cast<uint32_t>(type_of(args)) << shift, shift += 3), ...);
+
+		uint32_t *dst = &region.data[region.used_words];
+		*dst++ = header;
+		(store(dst, args), ...);
+		region.used_words += num_words;
+	}
+
+private:
+	template<typename T>
+	static constexpr ArgType type_of()
+	{
+		if constexpr (std::is_same_v<T, Hex>)
+			return HexValue;
+		else if constexpr (std::is_pointer_v<T> && sizeof(std::remove_pointer_t<T>) == 1)
+			return String;
+		else if constexpr (std::is_pointer_v<T>)
+			return HexValue;
+		else if constexpr (sizeof(T) == 8)
+			return std::is_signed_v<T> ? Int64 : Unsigned64;
+		else
+			return std::is_signed_v<T> ? Int : Unsigned;
+	}
+
+	template<typename T>
+	static ArgType type_of(T arg)
+	{
+		if constexpr (type_of<T>() == String)
+			return in_rodata(arg) ? String : CopiedString;
+		else
+			return type_of<T>();
+	}
+
+	template<typename T>
+	static uint32_t words_for(T arg)
+	{
+		if constexpr (type_of<T>() == String)
+			return in_rodata(arg) ? 1 : 1 + (copied_length(arg) + 3) / 4;
+		else
+			return (type_of<T>() == Int64 || type_of<T>() == Unsigned64) ? 2 : 1;
+	}
+
+	static bool in_rodata(const void *str)
+	{
+		auto p = static_cast<const char *>(str);
+		return p >= _rodata_start && p < _rodata_end;
+	}
+
+	static uint32_t copied_length(const void *str)
+	{
+		auto p = static_cast<const char *>(str);
+		uint32_t len = 0;
+		while (p && len < MaxStringChars && p[len])
+			len++;
+		return len;
+	}
+
+	// Byte by byte into the words, without turning into a memcpy() call
+	__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void
+	copy_string(uint32_t *&dst, const char *str, uint32_t len)
+	{
+		*dst++ = len;
+		for (uint32_t i = 0; i < len; i += 4) {
+			uint32_t word = 0;
+			for (uint32_t j = 0; j < 4 && i + j < len; j++)
+				word |= static_cast<uint32_t>(static_cast<uint8_t>(str[i + j])) << (j * 8);
+			*dst++ = word;
+		}
+	}
+
+	template<typename T>
+	static void store(uint32_t *&dst, T arg)
+	{
+		if constexpr (std::is_same_v<T, Hex>) {
+			*dst++ = arg.x;
+		} else if constexpr (type_of<T>() == String) {
+			auto str = reinterpret_cast<const char *>(arg);
+			if (in_rodata(str))
+				*dst++ = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(str));
+			else
+				copy_string(dst, str, copied_length(str));
+		} else if constexpr (std::is_pointer_v<T>) {
+			*dst++ = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(arg));
+		} else if constexpr (sizeof(T) == 8) {
+			*dst++ = static_cast<uint32_t>(arg);
+			*dst++ = static_cast<uint32_t>(static_cast<uint64_t>(arg) >> 32);
+		} else {
+			*dst++ = static_cast<uint32_t>(arg);
+		}
+	}
+};
@@ -2,6 +2,7 @@
 #include "drivers/clocks.hh"
 #include "drivers/i2c_conf.hh"
 #include "drivers/leds.hh"
+#include "drivers/norflash/qspi_flash_chip.h"
 
 namespace Board
 {
@@ -29,13 +30,111 @@ constexpr uint32_t ConsoleUART = UART4_BASE;
 constexpr PinConf UartRX{GPIO::B, PinNum::_2, PinAF::AF_8};
 constexpr PinConf UartTX{GPIO::G, PinNum::_11, PinAF::AF_6};
 
+// Measure and print the throughput of the boot media before loading the image
+constexpr bool RunBenchmarks = false;
+
+// Timestamp each boot stage and print a table of the times before jumping to the app.
+// Printing the table at 115200 baud adds about 50ms to the boot time.
+constexpr bool ProfileBoot = false;
+
+// Verify the image CRC with the CRC1 peripheral (fed by the MDMA) instead of the CPU
+constexpr bool UseHardwareCRC = true;
+
 namespace NORFlash
 {
 constexpr bool HasNORFlash = false;
+// Copy the image with the MDMA instead of the CPU
+constexpr bool UseMDMA = false;
 constexpr PinConf d2{};
 constexpr PinConf d3{};
+
+// Bank 2 pins, only used in dual-flash mode (chip.dual_flash = 1)
+constexpr PinConf bk2_ncs{};
+constexpr PinConf bk2_d0{};
+constexpr PinConf bk2_d1{};
+constexpr PinConf bk2_d2{};
+constexpr PinConf bk2_d3{};
+
+// Read the chip's SFDP tables at boot and use the fastest quad read it supports.
+// The chip descriptor below is used if SFDP is not found (and for the QSPI clock settings).
+// Not used in dual-flash mode.
+// This may set the chip's Quad Enable bit, in its non-volatile status register if it has
+// no volatile one (once: only if QE is clear). Off by default, so the status register is
+// never written unless you ask for it.
+constexpr bool UseSFDP = false;
+
+// Sweep the QSPI sample shift and delay block (DLYB) phase with test reads of the SSBL,
+// and raise the clock above chip.prescaler (up to MaxReadClock_Hz) while a sampling window remains.
+// Off by default: only turn it on after checking MaxReadClock_Hz and testing your board.
+constexpr bool CalibrateSampling = false;
+
+// The fastest clock the chip is rated for with chip.read_cmd and its dummy cycles, from the
+// datasheet (more dummy cycles often allow a faster clock). With UseSFDP, it must be the
+// rating of the command SFDP picks, with the dummy cycles SFDP gives.
+constexpr uint32_t MaxReadClock_Hz = 104000000;
+
+// 16MB, 1-1-4 Quad Output Fast Read at 266MHz/4 = 67MHz.
+// The 8 dummy cycles the chip needs are sent as 1 alt byte on 4 lines (2 cycles) + 6 dummy cycles
+constexpr QSPIFlashChip chip{
+	.size_bytes = 16 * 1024 * 1024,
+	.dual_flash = 0,
+	.prescaler = 3,
+	.sample_shift = 1,
+	.cs_high_cycles = 3,
+	.enter_4byte_addr_cmd = 0,
+	.enter_qpi_cmd = 0,
+	.read_cmd =
+		{
+			.instruction = 0x6B,
+			.instruction_lines = QSPI_LINES_1,
+			.address_lines = QSPI_LINES_1,
+			.address_bytes = 3,
+			.data_lines = QSPI_LINES_4,
+			.alt_byte_lines = QSPI_LINES_4,
+			.num_alt_bytes = 1,
+			.alt_byte_value = 0x00,
+			.dummy_cycles = 6,
+			.ddr = 0,
+			.send_instruction_once = 0,
+		},
+};
 } // namespace NORFlash
 
+namespace EMMC
+{
+// D0 - D3, CK and CMD are on the pins the BOOTROM uses for eMMC (SDMMC2).
+// D4 - D7 are only used with an 8-bit bus (BusWidth = 8), for example (ST EV1 board):
+// d4{GPIO::A, PinNum::_8, PinAF::AF_9}, d5{GPIO::A, PinNum::_9, PinAF::AF_10},
+// d6{GPIO::E, PinNum::_5, PinAF::AF_9}, d7{GPIO::D, PinNum::_3, PinAF::AF_9}
+constexpr uint32_t BusWidth = 4;
+constexpr PinConf d4{};
+constexpr PinConf d5{};
+constexpr PinConf d6{};
+constexpr PinConf d7{};
+
+// The eMMC's I/O supply (VCCQ) is 1.8V, which allows HS200
+constexpr bool IOVoltage1V8 = false;
+
+// Load the images from a boot partition (1 = BOOT1, 2 = BOOT2) instead of the GPT
+// partitions in the user area, at the addresses in boot_image_def.hh. 0 = use the GPT.
+// The GPT is still used if there's no image in the boot partition.
+constexpr uint32_t ImageBootPartition = 0;
+
+// Read the boot partition with the eMMC boot operation, which skips identifying and
+// setting up the device. The device streams the partition that's enabled for boot
+// (EXT_CSD PARTITION_CONFIG), so that must be ImageBootPartition. The bus width and
+// boot acknowledge must match EXT_CSD BOOT_BUS_CONDITIONS and PARTITION_CONFIG.
+// 1 bit is the device's default (BOOT_BUS_CONDITIONS = 0). 8 bits needs the D4 - D7 pins.
+// The stream starts at offset 0 of the partition, so it's only used for an image whose
+// address in boot_image_def.hh (EMMCBootPartSSBLAddr, EMMCBootPartAppAddr) is 0. Other
+// images are read at their address, after identifying the device.
+// With the default layout, the FSBL is at offset 0 (that's where the BOOTROM loads it
+// from) and the SSBL and app are at 256kB and 1.25MB, so this is off.
+constexpr bool UseBootOperation = false;
+constexpr uint32_t BootOperationBusWidth = 1;
+constexpr bool BootOperationAck = false;
+} // namespace EMMC
+
 namespace PMIC
 {
 constexpr bool HasSTPMIC = true;
@@ -0,0 +1,317 @@
+#pragma once
+#include "board_conf.hh"
+#include "boot_image_def.hh"
+#include "boot_sdmmc.hh"
+#include "compiler.h"
+#include "drivers/clocks.hh"
+#include "drivers/pinconf.hh"
+#include "drivers/rcc.hh"
+#include "print_messages.hh"
+
+struct BootEMMCLoader : BootSDMMCLoader {
+	BootEMMCLoader()
+		: BootSDMMCLoader{"eMMC", SDMMC2, DLYB_SDMMC2, BootImageDef::EMMCSSBLPartition, BootImageDef::EMMCAppPartition}
+	{
+		RCC->SDMMC12CKSELR = 3; // HSI = 64MHz
+		mdrivlib::RCC_Enable::SDMMC2_::set();
+
+		// These pins are not board-specific, they are required by BOOTROM
+		// for booting from eMMC with SDMMC2 (D0 - D3, CK, CMD)
+		PinConf{GPIO::B, PinNum::_14, PinAF::AF_9}.init(PinMode::Alt);
+		PinConf{GPIO::B, PinNum::_15, PinAF::AF_9}.init(PinMode::Alt);
+		PinConf{GPIO::B, PinNum::_3, PinAF::AF_9}.init(PinMode::Alt);
+		PinConf{GPIO::B, PinNum::_4, PinAF::AF_9}.init(PinMode::Alt);
+		PinConf{GPIO::E, PinNum::_3, PinAF::AF_9}.init(PinMode::Alt);
+		PinConf{GPIO::G, PinNum::_6, PinAF::AF_10}.init(PinMode::Alt);
+
+		if constexpr (Board::EMMC::BusWidth == 8 || Board::EMMC::BootOperationBusWidth == 8) {
+			Board::EMMC::d4.init(PinMode::Alt);
+			Board::EMMC::d5.init(PinMode::Alt);
+			Board::EMMC::d6.init(PinMode::Alt);
+			Board::EMMC::d7.init(PinMode::Alt);
+		}
+
+		// With the boot operation, the device is only identified if that fails
+		if (!use_boot_operation)
+			init_device();
+	}
+
+	BootImageDef::image_header read_image_header(LoadTarget target) override
+	{
+		if constexpr (Board::EMMC::ImageBootPartition != 0) {
+			if (use_boot_operation) {
+				// The device streams the partition from the start. Streaming up to an image
+				// further in is slower than identifying the device and reading at its address.
+				if (boot_partition_addr(target) == 0) {
+					if (read_header_by_boot_operation())
+						return boot_op_header;
+					log("eMMC: boot operation failed, identifying device\n");
+				}
+				use_boot_operation = false;
+				init_device();
+			}
+
+			BootImageDef::image_header header;
+			if (read_header_from_boot_partition(target, header))
+				return header;
+
+			log("eMMC: no image in boot partition, using GPT\n");
+			select_partition(UserArea);
+		}
+
+		return BootSDMMCLoader::read_image_header(target);
+	}
+
+	// If the boot operation fails part way, the handler has already seen part of the image,
+	// so this fails: stream_image() then reads the image again, header first.
+	bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target, ChunkHandler *handler) override
+	{
+		if (use_boot_operation) {
+			if (load_by_boot_operation(load_addr, size, handler))
+				return true;
+
+			log("eMMC: boot operation failed while loading, identifying device\n");
+			use_boot_operation = false;
+			boot_operation_failed = true;
+			init_device();
+			return false;
+		}
+
+		return BootSDMMCLoader::load_image(load_addr, size, target, handler);
+	}
+
+	// The boot operation is already one stream. Boot partitions are read header first,
+	// falling back to the GPT if there's no image in them.
+	bool stream_image(LoadTarget target, ImageHandler &handler) override
+	{
+		if constexpr (Board::EMMC::ImageBootPartition != 0) {
+			if (BootLoader::stream_image(target, handler))
+				return true;
+
+			// The header was good, so read the image from the same place the normal way.
+			// The handler starts over when it's given the header again.
+			if (!boot_operation_failed || has_error())
+				return false;
+			boot_operation_failed = false;
+			return BootLoader::stream_image(target, handler);
+		} else
+			return BootSDMMCLoader::stream_image(target, handler);
+	}
+
+private:
+	static_assert(Board::EMMC::BusWidth == 4 || Board::EMMC::BusWidth == 8);
+
+	static constexpr bool HasPinsD4toD7 = [] {
+		auto is_set = [](PinConf pin) { return pin.gpio != GPIO::Unused && pin.pin != PinNum::Unused; };
+		return is_set(Board::EMMC::d4) && is_set(Board::EMMC::d5) && is_set(Board::EMMC::d6) && is_set(Board::EMMC::d7);
+	}();
+	static_assert(Board::EMMC::BusWidth != 8 || HasPinsD4toD7, "An 8-bit eMMC bus needs the D4 - D7 pins");
+	static_assert(Board::EMMC::BootOperationBusWidth == 1 || Board::EMMC::BootOperationBusWidth == 4 ||
+				  (Board::EMMC::BootOperationBusWidth == 8 && HasPinsD4toD7),
+				  "The boot operation bus width must be 1, 4, or 8 with the D4 - D7 pins");
+
+	// EXT_CSD fields
+	static constexpr uint8_t ExtCSD_PartitionConfig = 179;
+	static constexpr uint8_t ExtCSD_BusWidth = 183;
+	static constexpr uint8_t ExtCSD_HSTiming = 185;
+	static constexpr uint8_t ExtCSD_DeviceType = 196;
+
+	// DEVICE_TYPE bits
+	static constexpr uint8_t DeviceType_HS52 = 1 << 1;
+	static constexpr uint8_t DeviceType_DDR52_1V8_3V = 1 << 2;
+	static constexpr uint8_t DeviceType_HS200_1V8 = 1 << 4;
+
+	// BUS_WIDTH values
+	static constexpr uint8_t BusWidthSDR = Board::EMMC::BusWidth == 8 ? 2 : 1;
+	static constexpr uint8_t BusWidthDDR = Board::EMMC::BusWidth == 8 ? 6 : 5;
+
+	// Clock while the device changes modes (legacy timing allows up to 26MHz)
+	static constexpr uint32_t SwitchClockDiv = 4;
+
+	// PARTITION_CONFIG PARTITION_ACCESS values
+	static constexpr uint8_t UserArea = 0;
+	static constexpr uint8_t PartitionAccessMask = 0x7;
+
+	static inline uint8_t ext_csd[512];
+
+	bool use_boot_operation = Board::EMMC::ImageBootPartition != 0 && Board::EMMC::UseBootOperation;
+	bool boot_operation_failed = false; // While loading: the image must be read again
+	BootImageDef::image_header boot_op_header;
+
+	// The BOOTROM reads the FSBL from a boot partition with the boot operation,
+	// which leaves the device in idle state, so it's always identified again.
+	void init_device()
+	{
+		if (!card.init_mmc(ext_csd)) {
+			init_error();
+			return;
+		}
+
+		card.set_clock_div(2); // 64MHz/2 / 2 = 16MHz, until negotiate_bus_speed() picks a faster mode
+		negotiate_bus_speed();
+	}
+
+	static uint32_t boot_partition_addr(LoadTarget target)
+	{
+		return target == LoadTarget::App ? BootImageDef::EMMCBootPartAppAddr : BootImageDef::EMMCBootPartSSBLAddr;
+	}
+
+	static bool is_image_header(const BootImageDef::image_header &header)
+	{
+		return be32_to_cpu(header.ih_magic) == BootImageDef::IH_MAGIC;
+	}
+
+	// Starts the boot operation and reads the image header, at the start of the partition.
+	// The stream is left there for load_by_boot_operation().
+	bool read_header_by_boot_operation()
+	{
+		static_assert(BootImageDef::HeaderSize % 32 == 0);
+
+		if (!card.start_boot_operation(Board::EMMC::BootOperationBusWidth, Board::EMMC::BootOperationAck))
+			return false;
+
+		bool ok = card.read_boot_data(reinterpret_cast<uint8_t *>(&boot_op_header), BootImageDef::HeaderSize) &&
+				  is_image_header(boot_op_header);
+
+		if (!ok)
+			card.end_boot_operation();
+		return ok;
+	}
+
+	// Reads the rest of the image from the boot operation stream, a chunk at a time
+	bool load_by_boot_operation(uint32_t load_addr, uint32_t size, ChunkHandler *handler)
+	{
+		constexpr uint32_t ChunkSize = 16 * 1024;
+
+		auto dst = reinterpret_cast<uint8_t *>(load_addr);
+		auto header = reinterpret_cast<const uint8_t *>(&boot_op_header);
+		for (uint32_t i = 0; i < BootImageDef::HeaderSize; i++)
+			dst[i] = header[i];
+		if (handler)
+			handler->chunk_loaded(dst, BootImageDef::HeaderSize);
+
+		const uint32_t end = (size + 31) & ~31;
+		uint32_t offset = BootImageDef::HeaderSize;
+		while (offset < end) {
+			uint32_t len = std::min(ChunkSize, end - offset);
+			if (!card.read_boot_data(dst + offset, len)) {
+				card.end_boot_operation();
+				return false;
+			}
+			if (handler && offset < size)
+				handler->chunk_loaded(dst + offset, std::min(len, size - offset));
+			offset += len;
+		}
+
+		card.end_boot_operation();
+		return true;
+	}
+
+	// After the device is identified, the boot partition can be read like the user area
+	bool read_header_from_boot_partition(LoadTarget target, BootImageDef::image_header &header)
+	{
+		if (!select_partition(Board::EMMC::ImageBootPartition))
+			return false;
+
+		image_blockaddr = boot_partition_addr(target) / SDMMC_Controller::BlockSize;
+		read(header, image_blockaddr);
+		return is_image_header(header);
+	}
+
+	bool select_partition(uint8_t partition)
+	{
+		uint8_t config = (ext_csd[ExtCSD_PartitionConfig] & ~PartitionAccessMask) | partition;
+		if (!card.mmc_switch(ExtCSD_PartitionConfig, config))
+			return false;
+		ext_csd[ExtCSD_PartitionConfig] = config;
+		return true;
+	}
+
+	struct BusMode {
+		const char *name;
+		uint8_t hs_timing;		   // EXT_CSD HS_TIMING: 0 = legacy, 1 = High Speed, 2 = HS200
+		bool ddr;				   // Data on both clock edges
+		uint32_t clock_div;		   // SDMMC_CK = PLL4_P / (2 * clock_div), or PLL4_P if 0
+		uint8_t device_type_mask; // DEVICE_TYPE bit the device must have, 0 for none
+	};
+
+	// Fastest first. Each mode the device supports is tried with a test read,
+	// falling back to the next one.
+	// HS200 needs the device's I/O at 1.8V, and a tuning procedure: the delay block
+	// sweep in calibrate_sampling() is used instead of CMD21.
+	// The SDMMC kernel clock is 100MHz (PLL4), which limits HS200 to 100MHz.
+	static constexpr BusMode bus_modes[] = {
+		{"HS200, 100MHz", 2, false, 0, DeviceType_HS200_1V8},
+		{"DDR52, 50MHz", 1, true, 1, DeviceType_DDR52_1V8_3V},
+		{"High Speed SDR, 50MHz", 1, false, 1, DeviceType_HS52},
+		{"Legacy, 25MHz", 0, false, 2, 0},
+		{"Legacy, 12.5MHz", 0, false, 4, 0},
+	};
+
+	// The device starts with a 1-bit bus and legacy timing, with a 16MHz clock from HSI.
+	// Move the SDMMC kernel clock to PLL4 (100MHz) and try faster modes, checking
+	// each one by reading a reference block and comparing it to what we read at 16MHz.
+	void negotiate_bus_speed()
+	{
+		if (!read_reference_block()) {
+			pr_err("eMMC: test read failed at default clock\n");
+			return;
+		}
+
+		// Slow down before switching to a faster kernel clock
+		card.set_clock_div(SwitchClockDiv * 2);
+		SystemClocks::init_pll4(Board::HSE_Clock_Hz);
+		mdrivlib::RCC_Clocks::SDMMC12ClockSrc::write(mdrivlib::RCC_Clocks::SDMMC12ClockSrcPLL4P);
+
+		const uint8_t device_type = ext_csd[ExtCSD_DeviceType];
+
+		for (auto &mode : bus_modes) {
+			if (mode.device_type_mask && !(device_type & mode.device_type_mask))
+				continue;
+
+			if (mode.hs_timing == 2 && !Board::EMMC::IOVoltage1V8)
+				continue;
+
+			if (!set_bus_mode(mode)) {
+				log("eMMC: could not switch to mode: ", mode.name, "\n");
+				continue;
+			}
+
+			if (calibrate_sampling()) {
+				print("eMMC: ", mode.name, ", ", Board::EMMC::BusWidth, "-bit\n");
+				return;
+			}
+
+			log("eMMC: test reads failed in mode: ", mode.name, "\n");
+		}
+
+		pr_err("eMMC: test reads failed in all bus modes\n");
+		_has_error = true;
+	}
+
+	// The bus width must be set with SDR timing, before switching to DDR.
+	// HS200 also needs the (SDR) bus width set before HS_TIMING.
+	bool set_bus_mode(const BusMode &mode)
+	{
+		card.set_clock_div(SwitchClockDiv);
+		card.set_ddr(false);
+		card.set_high_bus_speed(false);
+
+		if (!card.mmc_switch(ExtCSD_BusWidth, BusWidthSDR))
+			return false;
+		card.set_bus_width(Board::EMMC::BusWidth);
+
+		if (!card.mmc_switch(ExtCSD_HSTiming, mode.hs_timing))
+			return false;
+
+		if (mode.ddr) {
+			if (!card.mmc_switch(ExtCSD_BusWidth, BusWidthDDR))
+				return false;
+			card.set_ddr(true);
+		}
+
+		card.set_high_bus_speed(mode.hs_timing == 2);
+		card.set_clock_div(mode.clock_div);
+		return true;
+	}
+};
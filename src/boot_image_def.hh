@@ -11,9 +11,26 @@ constexpr uint32_t NorFlashSSBLAddr = 0x50000;
 constexpr uint32_t SDCardSSBLPartition = 3;
 constexpr uint32_t SDCardAppPartition = 4;
 
+// On eMMC, the FSBL is in the boot partitions, so the GPT (in the user area) starts with the SSBL
+constexpr uint32_t EMMCSSBLPartition = 1;
+constexpr uint32_t EMMCAppPartition = 2;
+
+// GPT partitions are found by name first, so the partition layout can change without
+// rebuilding MP1-Boot. If no partition has the name, the partition numbers above are used.
+constexpr char SSBLPartitionName[] = "ssbl";
+constexpr char AppPartitionName[] = "prog";
+
+// Offsets of the images in an eMMC boot partition (see Board::EMMC::ImageBootPartition).
+// The FSBL is at the start of the partition, and can be up to 256kB.
+constexpr uint32_t EMMCBootPartSSBLAddr = 0x40000;
+constexpr uint32_t EMMCBootPartAppAddr = 0x140000;
+
 constexpr uint32_t IH_MAGIC = 0x27051956; /* Image Magic Number		*/
 constexpr uint32_t IH_NMLEN = 32;		  /* Image Name Length		*/
 
+constexpr uint8_t IH_COMP_NONE = 0; /*  No	 Compression Used	*/
+constexpr uint8_t IH_COMP_LZ4 = 5;	/* lz4	 Compression Used	*/
+
 //  Legacy format image header,
 //  all data in network byte order (aka natural aka bigendian).
 //  Taken from u-boot include/image.h
@@ -3,6 +3,34 @@
 
 struct BootLoader {
 	enum class LoadTarget { App, SSBL };
+
+	// Notified each time a contiguous chunk of the image has landed in memory.
+	// Loaders that use DMA call this while the next chunk is being transferred,
+	// so the handler can do work (CRC, decompression) on data that's ready.
+	struct ChunkHandler {
+		virtual void chunk_loaded(const uint8_t *data, uint32_t size) = 0;
+	};
+
+	// Also told about the header as soon as it's in memory, before the rest of the image.
+	// header_loaded() says where the image goes (header included) and its size,
+	// or returns false if the header is not valid.
+	// If a loader fails part way and reads the image again, it calls header_loaded()
+	// again first: the handler must then forget the chunks it was given.
+	struct ImageHandler : ChunkHandler {
+		virtual bool header_loaded(const BootImageDef::image_header &header, uint32_t &load_addr, uint32_t &size) = 0;
+	};
+
 	virtual BootImageDef::image_header read_image_header(LoadTarget target) = 0;
-	virtual bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target) = 0;
+	virtual bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target, ChunkHandler *handler) = 0;
+
+	// Loads the image in one pass: media that can start reading before the header is
+	// parsed don't read it twice. By default, the header is read on its own first.
+	virtual bool stream_image(LoadTarget target, ImageHandler &handler)
+	{
+		uint32_t load_addr = 0;
+		uint32_t size = 0;
+		if (!handler.header_loaded(read_image_header(target), load_addr, size))
+			return false;
+		return load_image(load_addr, size, target, &handler);
+	}
 };
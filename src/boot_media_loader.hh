@@ -1,15 +1,73 @@
 #pragma once
 #include "boot_detect.hh"
+#include "boot_emmc.hh"
 #include "boot_image_def.hh"
 #include "boot_nor.hh"
+#include "boot_profiler.hh"
 #include "boot_sd.hh"
 #include "compiler.h"
+#include "crc/crc32.hh"
+#include "crc/crc_engine.hh"
+#include "drivers/ddr/stm32mp1_ram.h"
+#include "lz4/lz4_frame_decoder.hh"
+#include "mmu.h"
 #include "print_messages.hh"
 
 struct AppImageInfo {
-	uint32_t load_addr = 0;
+	uint32_t load_addr = 0; // where the image is read to from boot media
 	uint32_t entry_point = 0;
 	uint32_t size = 0;
+	uint8_t compression = BootImageDef::IH_COMP_NONE;
+	uint32_t data_crc = 0; // ih_dcrc: CRC of the image data (after the header), as loaded
+
+	// The executable image in memory, after decompressing
+	uint32_t exec_addr = 0;
+	uint32_t exec_size = 0;
+};
+
+// Decompresses an LZ4 image while it's being loaded.
+// Each chunk is passed on to the next handler (if any) before decompressing it.
+// The loader may be reading the next chunk meanwhile, and highly compressed data
+// would take much longer to decode than to read. So each chunk decodes to at most
+// a few times its size, and finish() decodes what's left once the image is in.
+struct LZ4ChunkHandler : BootLoader::ChunkHandler {
+	static constexpr uint32_t MaxOutputPerInputByte = 4;
+
+	LZ4FrameDecoder decoder;
+	BootLoader::ChunkHandler *next = nullptr;
+
+	void chunk_loaded(const uint8_t *data, uint32_t size) override
+	{
+		if (next)
+			next->chunk_loaded(data, size);
+		decoder.feed(data + size, size * MaxOutputPerInputByte);
+	}
+
+	LZ4FrameDecoder::Status finish(const uint8_t *data_end) { return decoder.feed(data_end); }
+};
+
+// Computes the CRC of the image data (skipping the header) as it's being loaded.
+// With the hardware CRC engine, this only starts a DMA transfer for each chunk.
+struct DataCRCChunkHandler : BootLoader::ChunkHandler {
+	CRCEngine crc;
+	uint32_t header_bytes_left = BootImageDef::HeaderSize;
+	BootLoader::ChunkHandler *next = nullptr;
+
+	void reset()
+	{
+		crc.reset();
+		header_bytes_left = BootImageDef::HeaderSize;
+	}
+
+	void chunk_loaded(const uint8_t *data, uint32_t size) override
+	{
+		uint32_t skip = std::min(size, header_bytes_left);
+		header_bytes_left -= skip;
+		crc.add(data + skip, size - skip);
+
+		if (next)
+			next->chunk_loaded(data, size);
+	}
 };
 
 class BootMediaLoader {
@@ -32,22 +90,53 @@ public:
 
 		_target = target;
 
-		BootImageDef::image_header header;
-		static_assert(sizeof(header) == BootImageDef::HeaderSize);
-
-		header = _loader->read_image_header(target);
+		ImageStream stream{*this};
+		bool ok = _loader->stream_image(target, stream);
 
-		if (!_parse_header(header)) {
+		// Logged afterwards: the rest of the image may be loading while the header is parsed
+		_log_header(stream.header);
+		if (!stream.header_ok) {
 			pr_err("No valid img header found\n");
 			return false;
 		}
+		log("Image load addr: 0x", Hex{_image_info.load_addr});
+		log(" entry_addr: 0x", Hex{_image_info.entry_point});
+		log(" size: ", Hex{_image_info.size}, "\n");
 
-		bool ok = _loader->load_image(_image_info.load_addr, _image_info.size, target);
 		if (!ok) {
 			pr_err("Failed reading boot media when loading app img\n");
 			return false;
 		}
+		BootProfiler::mark("load");
+
+		// For compressed images, this is the CRC of the compressed data
+		auto &crc = stream.crc;
+		uint32_t data_crc = crc.crc.value();
+		if (!crc.crc.ok()) {
+			log("CRC engine failed, checking image in software\n");
+			CRC32::Checksum sw_crc;
+			sw_crc.add(reinterpret_cast<const uint8_t *>(_image_info.load_addr + BootImageDef::HeaderSize),
+					   _image_info.size - BootImageDef::HeaderSize);
+			data_crc = sw_crc.value();
+		}
+
+		if (data_crc != _image_info.data_crc) {
+			pr_err("Image data CRC mismatch: calculated ", Hex{data_crc}, " expected ", Hex{_image_info.data_crc}, "\n");
+			return false;
+		}
+
+		if (_image_info.compression == BootImageDef::IH_COMP_LZ4) {
+			auto &lz4 = stream.lz4;
+			auto data_end = reinterpret_cast<const uint8_t *>(_image_info.load_addr + _image_info.size);
+			if (lz4.finish(data_end) != LZ4FrameDecoder::Status::Done) {
+				pr_err("Failed to decompress LZ4 image\n");
+				return false;
+			}
+			_image_info.exec_size = lz4.decoder.output_size();
+			log("Decompressed image size: ", Hex{_image_info.exec_size}, "\n");
+		}
 
+		BootProfiler::mark("verify");
 		_image_loaded = true;
 		return true;
 	}
@@ -64,9 +153,26 @@ public:
 
 		auto image_entry = reinterpret_cast<image_entry_noargs_t>(_image_info.entry_point);
 		log("image entry point: 0x", Hex{_image_info.entry_point}, "\n");
+
+		// Make sure the image is in DDR (not just in the caches),
+		// and leave the MMU off like the BOOTROM did
+		dcache_clean_invalidate_range(_image_info.exec_addr, _image_info.exec_size);
+		mmu_disable();
+
+		BootProfiler::mark("jump");
+		BootProfiler::report();
+
+		// The console is buffered: send everything before the app takes over the UART
+		print_flush();
+
 		image_entry();
 	}
 
+	// Optionally process the image as it's being loaded (e.g. verify a CRC).
+	// The handler is called with each chunk as soon as it's in memory.
+	// If the loader has to start over, the handler sees the image again from the start.
+	void set_chunk_handler(BootLoader::ChunkHandler *handler) { _chunk_handler = handler; }
+
 	// You may call this to change boot methods. For example
 	// if load_image() fails, you can try a different boot method
 	bool set_bootmethod(BootDetect::BootMethod new_boot_method)
@@ -76,14 +182,65 @@ public:
 	}
 
 private:
+	// Parses the header as soon as the loader has it, and sets up the chunk handlers
+	// (CRC, and LZ4 for compressed images) before the rest of the image comes in.
+	// The loader may be reading the next chunk meanwhile, so this doesn't log.
+	// If the loader starts over, the handlers start over too (see ImageHandler).
+	struct ImageStream : BootLoader::ImageHandler {
+		BootMediaLoader &media;
+		BootImageDef::image_header header{};
+		bool header_ok = false;
+
+		DataCRCChunkHandler crc;
+		LZ4ChunkHandler lz4;
+		BootLoader::ChunkHandler *first = nullptr;
+
+		ImageStream(BootMediaLoader &media_loader)
+			: media{media_loader}
+		{}
+
+		bool header_loaded(const BootImageDef::image_header &hdr, uint32_t &load_addr, uint32_t &size) override
+		{
+			header = hdr;
+			BootProfiler::mark("header read");
+
+			header_ok = media._parse_header(header);
+			if (!header_ok)
+				return false;
+
+			auto &info = media._image_info;
+			crc.reset();
+			crc.next = media._chunk_handler;
+			first = &crc;
+
+			if (info.compression == BootImageDef::IH_COMP_LZ4) {
+				// Decompress from the data (after the header) to the final address.
+				// The output must not run into the compressed data.
+				auto compressed = reinterpret_cast<const uint8_t *>(info.load_addr + BootImageDef::HeaderSize);
+				auto out = reinterpret_cast<uint8_t *>(info.exec_addr);
+				auto out_limit = reinterpret_cast<uint8_t *>(info.load_addr);
+				lz4.decoder.init(compressed, out, out_limit);
+				lz4.next = &crc;
+				first = &lz4;
+			}
+
+			load_addr = info.load_addr;
+			size = info.size;
+			return true;
+		}
+
+		void chunk_loaded(const uint8_t *data, uint32_t size) override { first->chunk_loaded(data, size); }
+	};
+
 	bool _image_loaded = false;
 	BootLoader::LoadTarget _target = App;
 
 	AppImageInfo _image_info;
+	BootLoader::ChunkHandler *_chunk_handler = nullptr;
 	// We don't have dynamic memory, so instead of having a static copy of each
 	// type of loader we use placement new.
 	// TODO: use std::variant
-	uint8_t loader_storage[std::max(sizeof(BootSDLoader), sizeof(BootNorLoader))];
+	uint8_t loader_storage[std::max({sizeof(BootSDLoader), sizeof(BootEMMCLoader), sizeof(BootNorLoader)})];
 	BootLoader *_loader;
 
 	// To support a new boot media (such as NAND Flash),
@@ -92,10 +249,44 @@ private:
 	{
 		return bootmethod == BootDetect::BOOT_NOR	 ? new (loader_storage) BootNorLoader :
 			   bootmethod == BootDetect::BOOT_SDCARD ? new (loader_storage) BootSDLoader :
+			   bootmethod == BootDetect::BOOT_EMMC	 ? new (loader_storage) BootEMMCLoader :
 													   static_cast<BootLoader *>(nullptr);
 	}
 
-	bool _parse_header(BootImageDef::image_header &header)
+	// Compressed images are loaded (header included) to the top of DDR,
+	// and decompressed to where the header says to load the image.
+	bool _set_staging_addr()
+	{
+		constexpr uint32_t align = 1024 * 1024;
+
+		_image_info.exec_addr = _image_info.entry_point;
+
+		uint32_t staging_size = (_image_info.size + align - 1) & ~(align - 1);
+		_image_info.load_addr = DRAM_MEM_BASE + (stm32mp1_ddr_get_size() - staging_size);
+
+		if (_image_info.exec_addr < DRAM_MEM_BASE || _image_info.exec_addr >= _image_info.load_addr) {
+			pr_err("Compressed image does not fit below the top of RAM\n");
+			return false;
+		}
+		return true;
+	}
+
+	// ih_hcrc is the CRC of the header with the ih_hcrc field set to 0
+	bool _check_header_crc(BootImageDef::image_header header)
+	{
+		uint32_t expected = be32_to_cpu(header.ih_hcrc);
+		header.ih_hcrc = 0;
+
+		CRC32::Checksum crc;
+		crc.add(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+		if (crc.value() != expected) {
+			pr_err("Image header CRC mismatch: calculated ", Hex{crc.value()}, " expected ", Hex{expected}, "\n");
+			return false;
+		}
+		return true;
+	}
+
+	void _log_header(const BootImageDef::image_header &header)
 	{
 		log("Raw header (big-endian):\n");
 		log("  ih_magic: ", Hex{header.ih_magic}, "\n");
@@ -116,9 +307,16 @@ private:
 			*p++ = c;
 		name_cstr[BootImageDef::IH_NMLEN] = 0;
 		log("  ih_name: ", name_cstr, "\n");
+	}
 
+	// Called while the image may be loading (see ImageStream): only log errors here
+	bool _parse_header(const BootImageDef::image_header &header)
+	{
 		uint32_t magic = be32_to_cpu(header.ih_magic);
 		if (magic == BootImageDef::IH_MAGIC) {
+			if (!_check_header_crc(header))
+				return false;
+
 			if (header.ih_load == 0) {
 				debug("ih_load is 0\n");
 				// On some system (e.g. powerpc), the load-address and
@@ -134,9 +332,18 @@ private:
 				_image_info.size = be32_to_cpu(header.ih_size) + header_size;
 			}
 
-			log("Image load addr: 0x", Hex{_image_info.load_addr});
-			log(" entry_addr: 0x", Hex{_image_info.entry_point});
-			log(" size: ", Hex{_image_info.size}, "\n");
+			_image_info.exec_addr = _image_info.load_addr;
+			_image_info.exec_size = _image_info.size;
+			_image_info.compression = header.ih_comp;
+			_image_info.data_crc = be32_to_cpu(header.ih_dcrc);
+
+			if (header.ih_comp == BootImageDef::IH_COMP_LZ4) {
+				if (!_set_staging_addr())
+					return false;
+			} else if (header.ih_comp != BootImageDef::IH_COMP_NONE) {
+				pr_err("Unsupported image compression type ", header.ih_comp, "\n");
+				return false;
+			}
 
 			return true;
 
@@ -2,9 +2,16 @@
 #include "board_conf.hh"
 #include "boot_image_def.hh"
 #include "boot_loader.hh"
+#include "drivers/dlyb.hh"
+#include "drivers/mdma.hh"
 #include "drivers/norflash/qspi_norflash_read.h"
+#include "drivers/norflash/qspi_sfdp.h"
 #include "drivers/pinconf.hh"
+#include "mmu.h"
 #include "print_messages.hh"
+#include <algorithm>
+#include <iterator>
+#include <optional>
 
 struct BootNorLoader : BootLoader {
 	BootNorLoader()
@@ -12,14 +19,38 @@ struct BootNorLoader : BootLoader {
 		Board::NORFlash::d2.init(PinMode::Alt);
 		Board::NORFlash::d3.init(PinMode::Alt);
 
-		QSPI_init();
+		if constexpr (Board::NORFlash::chip.dual_flash) {
+			Board::NORFlash::bk2_ncs.init(PinMode::Alt);
+			Board::NORFlash::bk2_d0.init(PinMode::Alt);
+			Board::NORFlash::bk2_d1.init(PinMode::Alt);
+			Board::NORFlash::bk2_d2.init(PinMode::Alt);
+			Board::NORFlash::bk2_d3.init(PinMode::Alt);
+		}
+
+		QSPIFlashChip chip = Board::NORFlash::chip;
+		QSPI_init(&chip);
+
+		// SFDP responses from two chips are interleaved, so don't try in dual-flash mode
+		if constexpr (Board::NORFlash::UseSFDP && !Board::NORFlash::chip.dual_flash) {
+			if (QSPI_sfdp_detect(&chip)) {
+				log("Using SFDP read command 0x", Hex{chip.read_cmd.instruction}, "\n");
+				QSPI_init(&chip);
+			} else
+				log("SFDP not found, using board conf QSPI read command\n");
+		}
+
+		// Map as much of the window as the flash actually has
+		mmu_map_qspi(QSPI_mapped_size(&chip));
+
+		if constexpr (Board::NORFlash::CalibrateSampling)
+			calibrate_sampling(chip);
 	}
 
 	BootImageDef::image_header read_image_header(LoadTarget target) override
 	{
 		BootImageDef::image_header header;
 
-		auto flashaddr = target == LoadTarget::App ? BootImageDef::NorFlashAppAddr : BootImageDef::NorFlashSSBLAddr;
+		auto flashaddr = window_offset(target);
 
 		auto ok = QSPI_read_MM((uint8_t *)(&header), flashaddr, BootImageDef::HeaderSize);
 		if (!ok) {
@@ -30,11 +61,189 @@ struct BootNorLoader : BootLoader {
 		return header;
 	}
 
-	bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target) override
+	bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target, ChunkHandler *handler) override
 	{
-		auto flashaddr = target == LoadTarget::App ? BootImageDef::NorFlashAppAddr : BootImageDef::NorFlashSSBLAddr;
+		return load(load_addr, window_offset(target), size, handler);
+	}
+
+	// The header is only read once: it's copied to the start of the image,
+	// and the rest of the image is read from after it.
+	bool stream_image(LoadTarget target, ImageHandler &handler) override
+	{
+		constexpr uint32_t header_size = BootImageDef::HeaderSize;
+		auto header = read_image_header(target);
+
+		uint32_t load_addr = 0;
+		uint32_t size = 0;
+		if (!handler.header_loaded(header, load_addr, size))
+			return false;
+
+		if (size <= header_size)
+			return load_image(load_addr, size, target, &handler);
+
+		auto dst = reinterpret_cast<uint8_t *>(load_addr);
+		auto src = reinterpret_cast<const uint8_t *>(&header);
+		for (uint32_t i = 0; i < header_size; i++)
+			dst[i] = src[i];
+		handler.chunk_loaded(dst, header_size);
+
+		return load(load_addr + header_size, window_offset(target) + header_size, size - header_size, &handler);
+	}
+
+private:
+	struct ClockSetting {
+		uint32_t prescaler;
+		uint32_t sample_shift;
+		int phase; // -1: delay block not used
+	};
+
+	// QUADSPI kernel clock: ACLK = PLL2_P, 266.5MHz with a 24MHz HSE
+	static constexpr uint32_t KernelClock_Hz = 266500000;
+
+	// The fastest setting allowed: the QSPI clock is KernelClock_Hz / (prescaler + 1)
+	static constexpr uint32_t MinClockDiv = (KernelClock_Hz + Board::NORFlash::MaxReadClock_Hz - 1) /
+											Board::NORFlash::MaxReadClock_Hz;
+	static constexpr uint32_t MinPrescaler = MinClockDiv > 1 ? MinClockDiv - 1 : 1;
+
+	// A setting passes if every one of these reads of the reference area matches
+	static constexpr uint32_t TestReadsPerSetting = 2;
+
+	// For the calibration test reads (static to keep them off the stack)
+	static inline uint8_t ref_block[4096];
+	static inline uint8_t test_block[4096];
+
+	// Starting at the board conf clock, raise the QSPI clock one prescaler step at a time, but
+	// not above the chip's rated clock. At each step, sweep the sample shift and the delay block
+	// phases with test reads, and use the centre of the widest passing window. Stop at the first
+	// step with no window, and keep the fastest one that had one.
+	static void calibrate_sampling(const QSPIFlashChip &chip)
+	{
+		auto flashaddr = window_offset(LoadTarget::SSBL);
+		QSPI_read_MM(ref_block, flashaddr, sizeof ref_block);
+
+		// Erased (or missing) flash, or data that never toggles some bits, can't tell good
+		// reads from bad ones on every data line
+		if (!toggles_all_bits(ref_block)) {
+			log("QSPI: not enough data to calibrate against\n");
+			return;
+		}
+
+		ClockSetting best{chip.prescaler, chip.sample_shift, -1};
+		bool found = false;
+
+		for (int prescaler = chip.prescaler; prescaler >= (int)MinPrescaler; prescaler--) {
+			auto setting = find_window(prescaler, chip.read_cmd.ddr, flashaddr);
+			if (!setting.has_value())
+				break;
+			best = *setting;
+			found = true;
+		}
+
+		apply(best);
+
+		if (found)
+			print("QSPI: 266MHz/", best.prescaler + 1, ", sample shift ", best.sample_shift, ", phase ", best.phase, "\n");
+		else
+			pr_err("QSPI: no passing sampling point found, using board conf clock\n");
+	}
+
+	static std::optional<ClockSetting> find_window(uint32_t prescaler, bool ddr, uint32_t flashaddr)
+	{
+		DelayBlock dlyb{DLYB_QUADSPI};
+		std::optional<ClockSetting> best;
+		uint32_t best_len = 0;
+
+		// Sample shift is not available in DDR mode
+		for (uint32_t sshift = 0; sshift < (ddr ? 1 : 2); sshift++) {
+			QSPI_set_clock(prescaler, sshift);
+
+			if (dlyb.calibrate()) {
+				bool pass[DelayBlock::MaxPhases]{};
+				uint32_t num_pass = 0;
+				for (uint32_t phase = 0; phase < dlyb.phases(); phase++) {
+					dlyb.set_phase(phase);
+					pass[phase] = test_read(flashaddr);
+					num_pass += pass[phase];
+				}
+
+				int centre = DelayBlock::window_centre(pass, dlyb.phases());
+				if (centre >= 0 && num_pass > best_len) {
+					best = ClockSetting{prescaler, sshift, centre};
+					best_len = num_pass;
+				}
+				dlyb.disable();
+
+			} else if (!best && test_read(flashaddr)) {
+				// Delay line can't cover a period at this clock: try without it
+				best = ClockSetting{prescaler, sshift, -1};
+			}
+		}
+
+		return best;
+	}
+
+	static void apply(const ClockSetting &setting)
+	{
+		DelayBlock dlyb{DLYB_QUADSPI};
+		QSPI_set_clock(setting.prescaler, setting.sample_shift);
+		if (setting.phase >= 0 && dlyb.calibrate())
+			dlyb.set_phase(setting.phase);
+		else
+			dlyb.disable();
+	}
+
+	static bool test_read(uint32_t flashaddr)
+	{
+		for (uint32_t i = 0; i < TestReadsPerSetting; i++) {
+			// Make sure the reads go to the flash
+			dcache_invalidate_range(QSPI_MEM_BASE + flashaddr, sizeof test_block);
+			QSPI_read_MM(test_block, flashaddr, sizeof test_block);
+			if (!std::equal(std::begin(ref_block), std::end(ref_block), test_block))
+				return false;
+		}
+		return true;
+	}
+
+	// Each bit of a byte (so each data line, in 4-bit and dual-flash modes) is seen at 0 and 1
+	static bool toggles_all_bits(const uint8_t (&block)[4096])
+	{
+		uint8_t ones = 0;
+		uint8_t zeros = 0;
+		for (auto b : block) {
+			ones |= b;
+			zeros |= ~b;
+		}
+		return ones == 0xFF && zeros == 0xFF;
+	}
+
+	static bool load(uint32_t load_addr, uint32_t flashaddr, uint32_t size, ChunkHandler *handler)
+	{
+		if constexpr (Board::NORFlash::UseMDMA) {
+			// MDMA needs doubleword alignment, otherwise fall back to the CPU copy
+			if (((load_addr | flashaddr) & 0x7) == 0) {
+				MDMACopy mdma;
+				return mdma.copy(load_addr, QSPI_MEM_BASE + flashaddr, size, [handler](uint32_t addr, uint32_t sz) {
+					if (handler)
+						handler->chunk_loaded(reinterpret_cast<const uint8_t *>(addr), sz);
+				});
+			}
+		}
 
 		auto load_dst = reinterpret_cast<uint8_t *>(load_addr);
-		return QSPI_read_MM(load_dst, flashaddr, size);
+		if (!QSPI_read_MM(load_dst, flashaddr, size))
+			return false;
+
+		// The CPU does the copy, so there's nothing to overlap: hand over the whole image at once
+		if (handler)
+			handler->chunk_loaded(load_dst, size);
+		return true;
+	}
+
+	// In dual-flash mode, each chip holds half of the image (see qspi_dual_split.py)
+	// at the same address as in single-flash mode, which is at twice that offset in the window.
+	static uint32_t window_offset(LoadTarget target)
+	{
+		auto flashaddr = target == LoadTarget::App ? BootImageDef::NorFlashAppAddr : BootImageDef::NorFlashSSBLAddr;
+		return Board::NORFlash::chip.dual_flash ? flashaddr * 2 : flashaddr;
 	}
 };
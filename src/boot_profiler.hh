@@ -0,0 +1,53 @@
+#pragma once
+#include "board_conf.hh"
+#include "drivers/generic_timer.hh"
+#include "print.hh"
+#include <cstdint>
+
+// Timestamps the stages of booting with the generic timer.
+// Call mark() at the end of each stage, and report() to print how long each one took.
+// The first mark is the time since the system counter started (around power-on),
+// which is mostly the BOOTROM loading the FSBL.
+// The stamps are kept in a fixed buffer in SYSRAM, so they can also be read with a debugger
+// (BootProfiler::trace). Stamps past MaxStamps are dropped.
+struct BootProfiler {
+	static constexpr uint32_t MaxStamps = 16;
+
+	struct Stamp {
+		const char *stage;
+		uint32_t ticks; // lower 32 bits of CNTPCT
+	};
+
+	struct Trace {
+		uint32_t count;
+		Stamp stamps[MaxStamps];
+	};
+
+	static inline Trace trace{};
+
+	// Records the end of a stage. The name must be a string literal (only the pointer is kept).
+	static void mark(const char *stage)
+	{
+		if constexpr (Board::ProfileBoot) {
+			if (trace.count < MaxStamps)
+				trace.stamps[trace.count++] = {stage, static_cast<uint32_t>(GenericTimer::ticks())};
+		}
+	}
+
+	static void report()
+	{
+		if constexpr (Board::ProfileBoot) {
+			print("\n%-16s%10s%21s\n", "Stage", "Time (us)", "Since power-on (us)");
+			uint32_t prev = 0;
+			for (uint32_t i = 0; i < trace.count; i++) {
+				auto &stamp = trace.stamps[i];
+				print("%-16s%10u%21u\n",
+					  stamp.stage,
+					  GenericTimer::ticks_to_us(stamp.ticks - prev),
+					  GenericTimer::ticks_to_us(stamp.ticks));
+				prev = stamp.ticks;
+			}
+			print("\n");
+		}
+	}
+};
@@ -1,23 +1,20 @@
 #pragma once
+#include "board_conf.hh"
 #include "boot_image_def.hh"
-#include "boot_loader.hh"
+#include "boot_sdmmc.hh"
+#include "drivers/clocks.hh"
 #include "drivers/pinconf.hh"
-#include "gpt/gpt.hh"
-#include "stm32mp1xx_hal_sd.h"
-#include <array>
+#include "drivers/rcc.hh"
+#include "print_messages.hh"
+#include <iterator>
 
-struct BootSDLoader : BootLoader {
+struct BootSDLoader : BootSDMMCLoader {
 	BootSDLoader()
+		: BootSDMMCLoader{
+			  "SD Card", SDMMC1, DLYB_SDMMC1, BootImageDef::SDCardSSBLPartition, BootImageDef::SDCardAppPartition}
 	{
 		RCC->SDMMC12CKSELR = 3; // HSI = 64MHz. Default value (just showing it here for educational purposes)
-
-		HAL_SD_DeInit(&hsd);
-		hsd.Instance = SDMMC1;
-		hsd.Init.ClockEdge = SDMMC_CLOCK_EDGE_RISING;
-		hsd.Init.ClockPowerSave = SDMMC_CLOCK_POWER_SAVE_DISABLE;
-		hsd.Init.BusWide = SDMMC_BUS_WIDE_4B;
-		hsd.Init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
-		hsd.Init.ClockDiv = 2; // 64MHz/2 / 2 = 16MHz, seems to be the max OSD32-BRK can handle reliably
+		mdrivlib::RCC_Enable::SDMMC1_::set();
 
 		// These pins are not board-specific, they are required by BOOTROM
 		// for booting with SDMMC1
@@ -31,124 +28,74 @@ struct BootSDLoader : BootLoader {
 		PinConf{GPIO::C, PinNum::_12, PinAF::AF_12}.init(PinMode::Alt);
 		PinConf{GPIO::D, PinNum::_2, PinAF::AF_12}.init(PinMode::Alt);
 
-		auto ok = HAL_SD_Init(&hsd);
-		if (ok != HAL_OK)
-			init_error();
-	}
-
-	BootImageDef::image_header read_image_header(LoadTarget target) override
-	{
-		auto image_part_num = target == LoadTarget::App ? app_part_num : ssbl_part_num;
-
-		BootImageDef::image_header header{};
-
-		// TODO: get_next_gpt_header(&gpt_hdr)
-		gpt_header gpt_hdr;
-		const uint32_t last_block = hsd.SdCard.BlockNbr;
-		const uint32_t gpt_addrs[2] = {1, last_block - 1};
-
-		for (auto blockaddr : gpt_addrs) {
-			read(gpt_hdr, blockaddr);
-			if (validate_gpt_header(&gpt_hdr, blockaddr, last_block)) {
-
-				image_blockaddr = get_gpt_partition_startaddr(gpt_hdr, image_part_num);
-				if (image_blockaddr != InvalidPartitionNum)
-					break;
+		if (card.resume()) {
+			log("SD Card: resumed BOOTROM session\n");
+		} else {
+			log("SD Card: could not resume BOOTROM session, re-initializing card\n");
+			if (!card.init()) {
+				init_error();
+				return;
 			}
 		}
-		if (image_blockaddr == InvalidPartitionNum) {
-			// pr_err("No valid GPT header found\n");
-			return {};
-		}
-
-		// log("GPT partition header says partition %d is at %llu. Reading\n", ssbl_part_num, ssbl_blockaddr);
-		read(header, image_blockaddr);
-		return header;
-	}
 
-	bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target) override
-	{
-		auto load_dst = reinterpret_cast<uint8_t *>(load_addr);
-		uint32_t num_blocks = (size + hsd.SdCard.BlockSize - 1) / hsd.SdCard.BlockSize;
-		// log("Reading %d blocks starting with block %llu from SD Card\n", num_blocks, ssbl_blockaddr);
-		auto err = HAL_SD_ReadBlocks(&hsd, load_dst, image_blockaddr, num_blocks, 0xFFFFFF);
-		return (err == HAL_OK);
+		card.set_clock_div(2); // 64MHz/2 / 2 = 16MHz, until negotiate_bus_speed() picks a faster mode
+		negotiate_bus_speed();
 	}
 
-	bool has_error() { return _has_error; }
-
 private:
-	static constexpr uint32_t ssbl_part_num = BootImageDef::SDCardSSBLPartition - 1;
-	static constexpr uint32_t app_part_num = BootImageDef::SDCardAppPartition - 1;
-
-	static constexpr uint32_t InvalidPartitionNum = 0xFFFFFFFF;
-
-	SD_HandleTypeDef hsd;
-	uint64_t image_blockaddr = 0;
-	bool _has_error = false;
-
-	// Given a gpt_header, find the starting address (LBA) of the SSBL partition
-	// Validate the gpt partition entry, too.
-	uint64_t get_gpt_partition_startaddr(gpt_header &gpt_hdr, uint32_t image_part_num)
+	struct BusMode {
+		const char *name;
+		uint32_t clock_div; // SDMMC_CK = PLL4_P / (2 * clock_div)
+		bool high_speed;	// Requires switching the card to High Speed with CMD6
+	};
+
+	// Fastest first. Each mode is tried with a test read, falling back to the next one.
+	// UHS-I modes (SDR50, SDR104) need 1.8V signaling, which must be negotiated
+	// during card identification and needs a level shifter that the supported
+	// boards don't have. So High Speed (which is SDR25's timing at 3.3V) is the fastest.
+	static constexpr BusMode bus_modes[] = {
+		{"High Speed, 50MHz", 1, true},
+		{"Default Speed, 25MHz", 2, false},
+		{"Default Speed, 12.5MHz", 4, false},
+	};
+
+	// The card starts in Default Speed mode with a 16MHz clock from HSI.
+	// Move the SDMMC kernel clock to PLL4 (100MHz) and try faster modes, checking
+	// each one by reading a reference block and comparing it to what we read at 16MHz.
+	void negotiate_bus_speed()
 	{
-		std::array<gpt_entry, 4> ptes;
-
-		// Make sure we're loading 512B into a variable that's 512B
-		static_assert(sizeof(ptes) == 512, "GPT Entry must be 128 Bytes");
-		if (hsd.SdCard.BlockSize != 512)
-			sdcard_error();
-
-		uint32_t part_lba = gpt_hdr.partition_entry_lba + (image_part_num / 4);
-		read(ptes, part_lba);
-		if (validate_partition_entry(ptes[image_part_num % 4])) {
-			return ptes[image_part_num % 4].starting_lba;
+		if (!read_reference_block()) {
+			pr_err("SD Card: test read failed at default clock\n");
+			return;
 		}
 
-		return InvalidPartitionNum;
-	}
+		// Slow down before switching to a faster kernel clock
+		card.set_clock_div(bus_modes[std::size(bus_modes) - 1].clock_div * 2);
+		SystemClocks::init_pll4(Board::HSE_Clock_Hz);
+		mdrivlib::RCC_Clocks::SDMMC12ClockSrc::write(mdrivlib::RCC_Clocks::SDMMC12ClockSrcPLL4P);
 
-	// Read from SD card into a generic data structure. Max one block (512B)
-	void read(auto &data, uint32_t block)
-	{
-		constexpr uint32_t numblocks = 1;
-		constexpr uint32_t timeout = 0xFFFFFF;
+		bool card_is_high_speed = false;
 
-		if constexpr (sizeof data == 512) {
-			// Size matches block size: read directly into data
-			auto err = HAL_SD_ReadBlocks(&hsd, (uint8_t *)&data, block, numblocks, timeout);
-			if (err != HAL_OK)
-				read_error();
-		} else if (sizeof data < 512) {
-			uint8_t _data[512];
-			auto err = HAL_SD_ReadBlocks(&hsd, _data, block, numblocks, timeout);
-			if (err != HAL_OK)
-				read_error();
+		for (auto &mode : bus_modes) {
+			if (mode.high_speed && !card_is_high_speed) {
+				if (!card.switch_to_high_speed()) {
+					log("SD Card: could not switch to High Speed\n");
+					continue;
+				}
+				card_is_high_speed = true;
+			}
 
-			auto *dst = (uint8_t *)(&data);
-			auto *src = (uint8_t *)_data;
-			auto sz = sizeof(data);
-			while (sz--)
-				*dst++ = *src++;
-		} else {
-			static_assert(sizeof data <= 512, "Multiblock reads not yet supported");
-		}
-	}
+			card.set_clock_div(mode.clock_div);
 
-	void init_error()
-	{
-		_has_error = true;
-		// 	panic("SDInit not ok");
-	}
+			if (calibrate_sampling()) {
+				print("SD Card: ", mode.name, "\n");
+				return;
+			}
 
-	void sdcard_error()
-	{
-		_has_error = true;
-		// panic("SD Card block size is not 512!");
-	}
+			log("SD Card: test reads failed in mode: ", mode.name, "\n");
+		}
 
-	void read_error()
-	{
+		pr_err("SD Card: test reads failed in all bus modes\n");
 		_has_error = true;
-		// panic("HAL Read SD not ok");
 	}
 };
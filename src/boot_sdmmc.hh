@@ -0,0 +1,334 @@
+#pragma once
+#include "boot_image_def.hh"
+#include "boot_loader.hh"
+#include "drivers/dlyb.hh"
+#include "drivers/sdmmc.hh"
+#include "gpt/gpt.hh"
+#include "gpt/gpt_cache.hh"
+#include "gpt/gpt_partitions.hh"
+#include "print_messages.hh"
+#include <algorithm>
+
+// Finds the image's partition in the GPT and loads it, for the loaders of
+// block devices on an SDMMC peripheral (SD Card, eMMC).
+// The derived class brings up the card in its constructor.
+struct BootSDMMCLoader : BootLoader {
+	BootSDMMCLoader(const char *media_name,
+					SDMMC_TypeDef *sdmmc,
+					DLYB_TypeDef *dlyb,
+					uint32_t ssbl_partition,
+					uint32_t app_partition)
+		: card{sdmmc}
+		, name{media_name}
+		, dlyb_instance{dlyb}
+		, partition_queries{
+			  {BootImageDef::AppPartitionName, nullptr, app_partition},
+			  {BootImageDef::SSBLPartitionName, nullptr, ssbl_partition},
+		  }
+	{}
+
+	BootImageDef::image_header read_image_header(LoadTarget target) override
+	{
+		BootImageDef::image_header header{};
+		if (!find_image_partition(target))
+			return header;
+
+		read(header, image_blockaddr);
+		return header;
+	}
+
+	// Reads the whole image with one multi-block read. The header is parsed as soon as
+	// the first chunk is in, and the rest of the image goes straight to where it says.
+	bool stream_image(LoadTarget target, ImageHandler &handler) override
+	{
+		uint32_t image_load_addr = 0;
+		uint32_t image_size = 0;
+
+		// Like read_image_header(), the handler sees a blank header
+		if (!find_image_partition(target))
+			return handler.header_loaded(BootImageDef::image_header{}, image_load_addr, image_size);
+
+		bool reading_image = false;
+		auto get_dest = [&](const uint8_t *first_chunk) -> SDMMC_Controller::StreamDest {
+			auto &header = *reinterpret_cast<const BootImageDef::image_header *>(first_chunk);
+			if (!handler.header_loaded(header, image_load_addr, image_size))
+				return {};
+
+			if (image_size > SDMMC_Controller::MaxBlocksPerRead * SDMMC_Controller::BlockSize) {
+				pr_err(name, ": image too large for a single DMA transfer\n");
+				return {};
+			}
+			if (image_load_addr & 0x3) {
+				pr_err(name, ": image load address must be word-aligned\n");
+				return {};
+			}
+
+			reading_image = true;
+			return {reinterpret_cast<uint8_t *>(image_load_addr), image_size};
+		};
+
+		auto ok = card.stream_blocks_dma<StreamChunkSize>(scratch, image_blockaddr, get_dest, [&](uint32_t offset, uint32_t len) {
+			handler.chunk_loaded(reinterpret_cast<const uint8_t *>(image_load_addr + offset), len);
+		});
+
+		if (!ok && reading_image)
+			dma_error();
+		return ok;
+	}
+
+	// Streams the image straight into memory using the SDMMC internal DMA,
+	// passing each chunk to the handler as soon as it's loaded.
+	bool load_image(uint32_t load_addr, uint32_t size, LoadTarget target, ChunkHandler *handler) override
+	{
+		auto load_dst = reinterpret_cast<uint8_t *>(load_addr);
+		uint32_t num_blocks = (size + SDMMC_Controller::BlockSize - 1) / SDMMC_Controller::BlockSize;
+		// log("Reading %d blocks starting with block %llu from SD Card\n", num_blocks, ssbl_blockaddr);
+
+		if (num_blocks == 0)
+			return true;
+
+		if (num_blocks == 1) {
+			auto ok = card.read_blocks(load_dst, image_blockaddr, num_blocks);
+			if (ok && handler)
+				handler->chunk_loaded(load_dst, size);
+			return ok;
+		}
+
+		if (num_blocks > SDMMC_Controller::MaxBlocksPerRead) {
+			pr_err(name, ": image too large for a single DMA transfer\n");
+			return false;
+		}
+
+		// The handler gets the image, not the padding at the end of the last block
+		auto ok = card.read_blocks_dma<DMAChunkSize>(load_dst, image_blockaddr, num_blocks, [=](uint32_t offset, uint32_t len) {
+			if (handler && offset < size)
+				handler->chunk_loaded(load_dst + offset, std::min(len, size - offset));
+		});
+
+		if (!ok)
+			dma_error();
+		return ok;
+	}
+
+	bool has_error() { return _has_error; }
+
+	SDMMC_Controller &controller() { return card; }
+
+protected:
+	SDMMC_Controller card;
+	const char *name;
+	bool _has_error = false;
+
+	// Set by read_image_header(), where load_image() reads from
+	uint64_t image_blockaddr = 0;
+
+	// Finds the image's partition in the GPT, and sets image_blockaddr.
+	// After a reset, the partition is usually in the GPT cache: then only the
+	// GPT header is read, to check it's the one the cache was filled from.
+	bool find_image_partition(LoadTarget target)
+	{
+		auto slot = static_cast<uint32_t>(target);
+		image_blockaddr = InvalidPartitionNum;
+
+		gpt_header gpt_hdr;
+
+		if (auto cached = GPTCache::find(card.cid(), slot, partition_queries[slot].id())) {
+			// A failed read here is not an error: the GPT is parsed as usual
+			auto &hdr = *reinterpret_cast<const gpt_header *>(scratch);
+			if (card.read_blocks(scratch, cached->gpt_lba, 1) && hdr.signature == GPT_HEADER_SIGNATURE_UBOOT &&
+				hdr.header_crc32 == cached->gpt_crc)
+			{
+				image_blockaddr = cached->blockaddr;
+				return true;
+			}
+			log(name, ": GPT changed, not using the cached partition address\n");
+		}
+
+		// TODO: get_next_gpt_header(&gpt_hdr)
+		const uint32_t last_block = card.num_blocks();
+		const uint32_t gpt_addrs[2] = {1, last_block - 1};
+
+		auto read_blocks = [this](uint8_t *dst, uint32_t lba, uint32_t num_blocks) {
+			return card.read_blocks(dst, lba, num_blocks);
+		};
+
+		for (auto blockaddr : gpt_addrs) {
+			read(gpt_hdr, blockaddr);
+			if (!validate_gpt_header(&gpt_hdr, blockaddr, last_block))
+				continue;
+
+			// Both images' partitions are found (and cached) in one pass
+			uint64_t start_lbas[NumTargets];
+			if (!GPTPartitions::find(gpt_hdr, scratch, read_blocks, partition_queries, start_lbas))
+				continue;
+
+			for (uint32_t i = 0; i < NumTargets; i++) {
+				if (start_lbas[i] != GPTPartitions::NotFound)
+					GPTCache::store(card.cid(), blockaddr, gpt_hdr.header_crc32, i, partition_queries[i].id(), start_lbas[i]);
+			}
+
+			if (start_lbas[slot] != GPTPartitions::NotFound) {
+				image_blockaddr = start_lbas[slot];
+				break;
+			}
+		}
+
+		// pr_err("No valid GPT header found\n");
+		return image_blockaddr != InvalidPartitionNum;
+	}
+
+	// Reads a block at a slow, safe clock, to compare the test reads with.
+	// Block 0 (the protective MBR) is mostly zeros, so most data lines would never toggle
+	// and a bad sampling point could pass. The first choice is the start of the first
+	// partition (code or a filesystem), then the GPT partition entries (GUIDs), then the
+	// GPT header: the first that has every bit of a byte at both 0 and 1.
+	bool read_reference_block()
+	{
+		uint32_t candidates[3]{};
+		uint32_t num_candidates = 0;
+
+		if (!card.read_blocks(ref_block, 1, 1))
+			return false;
+
+		auto &hdr = *reinterpret_cast<const gpt_header *>(ref_block);
+		if (hdr.signature == GPT_HEADER_SIGNATURE_UBOOT && hdr.partition_entry_lba < card.num_blocks()) {
+			uint32_t entries_lba = hdr.partition_entry_lba;
+			if (card.read_blocks(ref_block, entries_lba, 1)) {
+				uint64_t first_lba = reinterpret_cast<const gpt_entry *>(ref_block)->starting_lba;
+				if (first_lba > entries_lba && first_lba < card.num_blocks())
+					candidates[num_candidates++] = first_lba;
+			}
+			candidates[num_candidates++] = entries_lba;
+		}
+		candidates[num_candidates++] = 1;
+
+		for (uint32_t i = 0; i < num_candidates; i++) {
+			ref_blockaddr = candidates[i];
+			if (!card.read_blocks(ref_block, ref_blockaddr, 1))
+				return false;
+			if (toggles_all_bits(ref_block))
+				break;
+		}
+		return true;
+	}
+
+	// Sweep the receive clock through the delay block's phases, and use the
+	// centre of the widest window of passing test reads.
+	// If the delay line can't be calibrated (clock too slow) or no phase passes,
+	// sample on the card's clock (no delay) if that passes.
+	bool calibrate_sampling()
+	{
+		DelayBlock dlyb{dlyb_instance};
+
+		if (dlyb.calibrate()) {
+			bool pass[DelayBlock::MaxPhases]{};
+
+			card.set_rx_clock(2); // sdmmc_fb_ck
+			for (uint32_t phase = 0; phase < dlyb.phases(); phase++) {
+				dlyb.set_phase(phase);
+				pass[phase] = test_read();
+			}
+
+			int centre = DelayBlock::window_centre(pass, dlyb.phases());
+			if (centre >= 0) {
+				dlyb.set_phase(centre);
+				log(name, ": sampling phase ", centre, " of ", dlyb.phases(), "\n");
+				return true;
+			}
+		}
+
+		dlyb.disable();
+		card.set_rx_clock(0); // sdmmc_io_in_ck
+		return test_read();
+	}
+
+	void init_error()
+	{
+		_has_error = true;
+		// 	panic("SDInit not ok");
+	}
+
+	// Read from the card into a generic data structure. Max one block (512B)
+	void read(auto &data, uint32_t block)
+	{
+		constexpr uint32_t numblocks = 1;
+
+		if constexpr (sizeof data == 512) {
+			// Size matches block size: read directly into data
+			if (!card.read_blocks((uint8_t *)&data, block, numblocks))
+				read_error();
+		} else if (sizeof data < 512) {
+			uint8_t _data[512];
+			if (!card.read_blocks(_data, block, numblocks))
+				read_error();
+
+			auto *dst = (uint8_t *)(&data);
+			auto *src = (uint8_t *)_data;
+			auto sz = sizeof(data);
+			while (sz--)
+				*dst++ = *src++;
+		} else {
+			static_assert(sizeof data <= 512, "Multiblock reads not yet supported");
+		}
+	}
+
+private:
+	static constexpr uint32_t InvalidPartitionNum = 0xFFFFFFFF;
+
+	// Size of each IDMA buffer
+	static constexpr uint32_t DMAChunkSize = 64 * 1024;
+
+	// Smaller when streaming: the first two chunks are copied from scratch,
+	// and the header must be parsed while the second one is read
+	static constexpr uint32_t StreamChunkSize = 8 * 1024;
+
+	// For the GPT partition entries (16kB holds the usual 128), then for streaming the image
+	alignas(32) static inline uint8_t scratch[2 * StreamChunkSize];
+
+	// Indexed by LoadTarget
+	static constexpr uint32_t NumTargets = 2;
+
+	DLYB_TypeDef *dlyb_instance;
+	const GPTPartitionQuery partition_queries[NumTargets];
+
+	// For the bus mode test reads (static to keep them off the stack)
+	static inline uint8_t ref_block[512];
+	static inline uint8_t test_block[512];
+	uint32_t ref_blockaddr = 0;
+
+	static bool toggles_all_bits(const uint8_t *block)
+	{
+		uint8_t ones = 0;
+		uint8_t zeros = 0;
+		for (uint32_t i = 0; i < 512; i++) {
+			ones |= block[i];
+			zeros |= ~block[i];
+		}
+		return ones == 0xFF && zeros == 0xFF;
+	}
+
+	bool test_read()
+	{
+		// About 1ms at 50MHz: a bad sampling point can miss the start bit
+		constexpr uint32_t timeout_clocks = 50000;
+		bool ok = card.read_blocks(test_block, ref_blockaddr, 1, timeout_clocks);
+		ok = ok && std::equal(std::begin(ref_block), std::end(ref_block), test_block);
+		if (!ok)
+			card.recover();
+		return ok;
+	}
+
+	void dma_error()
+	{
+		if (card.dma_overrun())
+			pr_err(name, ": DMA read overrun, a chunk took too long to process\n");
+		else
+			pr_err(name, ": DMA read error, STA = ", Hex{card.last_status()}, "\n");
+	}
+
+	void read_error()
+	{
+		_has_error = true;
+		// panic("Read SD not ok");
+	}
+};
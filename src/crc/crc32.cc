@@ -0,0 +1,113 @@
+#include "crc32.hh"
+#include "drivers/benchmark_report.hh"
+#include "drivers/crc.hh"
+#include "drivers/cycle_counter.hh"
+#include "mmu.h"
+#include "print.hh"
+#include <array>
+
+extern "C" {
+#include "crc32.h"
+}
+
+namespace CRC32
+{
+
+constexpr uint32_t Polynomial = 0xEDB88320;
+constexpr unsigned NumSlices = 8;
+
+using Tables = std::array<std::array<uint32_t, 256>, NumSlices>;
+
+// tables[0] is the usual byte-wise table.
+// tables[k][n] is the CRC of byte n followed by k zero bytes,
+// so each of the 8 bytes in a word pair can be looked up independently.
+static constexpr Tables make_tables()
+{
+	Tables t{};
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? Polynomial ^ (c >> 1) : c >> 1;
+		t[0][n] = c;
+	}
+	for (unsigned slice = 1; slice < NumSlices; slice++) {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = t[slice - 1][n];
+			t[slice][n] = t[0][c & 0xFF] ^ (c >> 8);
+		}
+	}
+	return t;
+}
+
+static constexpr Tables tables = make_tables();
+static_assert(tables[0][1] == 0x77073096);
+static_assert(tables[0][128] == Polynomial);
+
+using aliased_uint32_t = uint32_t __attribute__((may_alias));
+
+uint32_t update(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	// Bytes until we're word-aligned (no unaligned accesses allowed)
+	while (len && (reinterpret_cast<uint32_t>(buf) & 3)) {
+		crc = tables[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+	// 8 bytes at a time. Assumes little-endian words.
+	auto *w = reinterpret_cast<const aliased_uint32_t *>(buf);
+	while (len >= 8) {
+		uint32_t lo = *w++ ^ crc;
+		uint32_t hi = *w++;
+		crc = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^ tables[5][(lo >> 16) & 0xFF] ^
+			  tables[4][lo >> 24] ^ tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF] ^
+			  tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+		len -= 8;
+	}
+
+	buf = reinterpret_cast<const uint8_t *>(w);
+	while (len--)
+		crc = tables[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+void benchmark(const uint8_t *buf, uint32_t size, uint32_t cpu_hz)
+{
+	CycleCounter::init();
+
+	// Start with the data in DDR, not in the caches
+	dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(buf), size);
+
+	uint32_t start = CycleCounter::read();
+	Checksum crc;
+	crc.add(buf, size);
+	uint32_t sw_cycles = CycleCounter::read() - start;
+
+	HardwareCRC hw;
+	start = CycleCounter::read();
+	hw.add(buf, size);
+	uint32_t hw_cpu_cycles = CycleCounter::read() - start;
+	uint32_t hw_crc = hw.value();
+	uint32_t hw_cycles = CycleCounter::read() - start;
+
+	print("CRC32 benchmark:\n");
+	report_throughput("  Software:           ", size, sw_cycles, cpu_hz);
+	report_throughput("  CRC1+MDMA:          ", size, hw_cycles, cpu_hz);
+	report_throughput("  CRC1+MDMA CPU time: ", size, hw_cpu_cycles, cpu_hz);
+	if (!hw.ok() || hw_crc != crc.value())
+		print("  CRC1 result ", Hex{hw_crc}, " does not match software ", Hex{crc.value()}, "\n");
+}
+
+} // namespace CRC32
+
+// C API used by the U-Boot ports (GPT)
+
+uint32_t crc32_no_comp(uint32_t crc, const unsigned char *buf, uint len)
+{
+	return CRC32::update(crc, buf, len);
+}
+
+uint32_t crc32(uint32_t crc, const unsigned char *buf, uint len)
+{
+	return ~CRC32::update(~crc, buf, len);
+}
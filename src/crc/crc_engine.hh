@@ -0,0 +1,58 @@
+#pragma once
+#include "board_conf.hh"
+#include "crc/crc32.hh"
+#include "drivers/crc.hh"
+#include <optional>
+
+// CRC-32 of a stream of buffers (same result as crc32()).
+// Uses the CRC1 peripheral fed by the MDMA if the board enables it, so the CPU
+// only has to start each transfer. Falls back to software if the peripheral
+// doesn't give the right result for a known string.
+class CRCEngine {
+	std::optional<HardwareCRC> hw;
+	CRC32::Checksum sw;
+
+public:
+	CRCEngine()
+	{
+		if constexpr (Board::UseHardwareCRC) {
+			hw.emplace();
+			if (!self_test())
+				hw = std::nullopt;
+		}
+	}
+
+	// With the hardware backend, the buffer must stay unchanged until the next add() or value()
+	void add(const uint8_t *buf, uint32_t size)
+	{
+		if (hw)
+			hw->add(buf, size);
+		else
+			sw.add(buf, size);
+	}
+
+	uint32_t value() { return hw ? hw->value() : sw.value(); }
+
+	// Starts a new CRC
+	void reset()
+	{
+		if (hw)
+			hw->reset();
+		sw = CRC32::Checksum{};
+	}
+
+	// False if the hardware backend had a DMA error, so value() is not valid
+	bool ok() const { return !hw || hw->ok(); }
+
+	bool is_hardware() const { return hw.has_value(); }
+
+private:
+	bool self_test()
+	{
+		static constexpr uint8_t check_str[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+		hw->add(check_str, sizeof check_str);
+		bool pass = hw->value() == 0xCBF43926;
+		hw->reset();
+		return pass;
+	}
+};
@@ -1,12 +1,39 @@
 #pragma once
+#include "stm32mp1xx.h"
+#include <stdbool.h>
 #include <stdint.h>
 
-// FIXME: not really usec
+// Delays and timeouts, timed by the generic timer's count (CNTPCT), so they don't
+// depend on the MPU clock or caches. The STGEN must be running and CNTFRQ set,
+// which GenericTimer::init() does at the start of main().
+// Only the lower 32 bits of the count are used: a delay or timeout can be up
+// to about 178 seconds with a 24MHz counter.
+
+static inline uint32_t timer_ticks(void)
+{
+	__ISB();
+	return (uint32_t)__get_CNTPCT();
+}
+
+static inline uint32_t timer_ticks_per_us(void) { return __get_CNTFRQ() / 1000000; }
+
+typedef struct {
+	uint32_t start;
+	uint32_t ticks;
+} deadline_t;
+
+// Starts a timeout. Poll it with deadline_passed()
+static inline deadline_t deadline_us(uint32_t usec)
+{
+	deadline_t deadline = {timer_ticks(), usec * timer_ticks_per_us()};
+	return deadline;
+}
+
+static inline bool deadline_passed(deadline_t deadline) { return (timer_ticks() - deadline.start) >= deadline.ticks; }
+
 static inline void udelay(uint32_t usec)
 {
-	const uint32_t loops_per_us = 5;
-	const uint32_t loops = usec * loops_per_us;
-	volatile uint32_t t = loops;
-	while (t)
-		t = t - 1;
+	deadline_t deadline = deadline_us(usec);
+	while (!deadline_passed(deadline))
+		;
 }
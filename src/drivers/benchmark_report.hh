@@ -0,0 +1,15 @@
+#pragma once
+#include "print.hh"
+#include <cstdint>
+
+// Prints the time and throughput of a benchmark run, from a CycleCounter count
+inline void report_throughput(const char *name, uint32_t size, uint32_t cycles, uint32_t cpu_hz)
+{
+	uint32_t us = cycles / (cpu_hz / 1000000);
+	if (us == 0)
+		us = 1;
+
+	// Bytes per us = MB/s
+	uint32_t mbps_x10 = size / us * 10 + (size % us) * 10 / us;
+	print(name, size, " bytes in ", us, "us = ", mbps_x10 / 10, ".", mbps_x10 % 10, " MB/s\n");
+}
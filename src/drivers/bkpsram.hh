@@ -0,0 +1,27 @@
+#pragma once
+#include "drivers/rcc.hh"
+#include "stm32mp1xx.h"
+#include <cstdint>
+
+// The 4kB backup SRAM keeps its contents through resets (but not through power cycles),
+// so it can hold what was slow to find out on one boot, for the next one.
+// Each user has a fixed area at the top, so the app can use the rest.
+// After power-up the contents are random: users must check what they read (magic number, CRC).
+// Writing needs backup domain access (PWR_CR1_DBP, see security_init()).
+struct BackupSRAM {
+	static constexpr uint32_t Size = 4096;
+
+	// Areas used by the FSBL
+	static constexpr uint32_t GPTCacheOffset = Size - 0x100;
+	static constexpr uint32_t DDRCalibrationOffset = Size - 0x200;
+	static constexpr uint32_t ResetFlagsOffset = Size - 0x300;
+
+	static void init() { mdrivlib::RCC_Enable::BKPSRAM_::set(); }
+
+	template<typename T>
+	static T &at(uint32_t offset)
+	{
+		static_assert(sizeof(T) <= 0x100, "Backup SRAM areas are 256 bytes");
+		return *reinterpret_cast<T *>(BKPSRAM_BASE + offset);
+	}
+};
@@ -133,4 +133,46 @@ struct SystemClocks {
 		SystemCoreClock = static_cast<uint32_t>(coreclock);
 		return SystemCoreClock;
 	}
+
+	// PLL4 is used for peripheral kernel clocks (SDMMC).
+	// HSE / 4MHz * 150 = 600MHz VCO, P output = 600MHz / 6 = 100MHz (for a 24MHz HSE).
+	// Call after init_core_clocks() (HSE must be on). Returns the P output frequency.
+	static uint32_t init_pll4(uint32_t HSE_Clock = 24000000)
+	{
+		const uint32_t pll4m = HSE_Clock / 4000000;
+		constexpr uint32_t pll4n = 150;
+		constexpr uint32_t pll4p = 6;
+		constexpr uint32_t pll4q = 6;
+		constexpr uint32_t pll4r = 6;
+
+		using namespace mdrivlib::RCC_Clocks;
+
+		PLL4::DIVPEnable::clear();
+		PLL4::DIVQEnable::clear();
+		PLL4::DIVREnable::clear();
+		PLL4::Enable::clear();
+		while (PLL4::Ready::read())
+			;
+
+		PLL4Source::write(PLL4SourceHSE);
+		while (!PLL4SourceReady::read())
+			;
+
+		PLL4::DIVM4::write(pll4m - 1);
+		PLL4::InputFreqRange::write(0); // 4-8MHz
+		PLL4::DIVN::write(pll4n - 1);
+		PLL4::DIVP::write(pll4p - 1);
+		PLL4::DIVQ::write(pll4q - 1);
+		PLL4::DIVR::write(pll4r - 1);
+		PLL4::FRACLatch::clear();
+		PLL4::FRACValue::write(0);
+		PLL4::FRACLatch::set();
+
+		PLL4::Enable::set();
+		while (!PLL4::Ready::read())
+			;
+		PLL4::DIVPEnable::set();
+
+		return HSE_Clock / pll4m * pll4n / pll4p;
+	}
 };
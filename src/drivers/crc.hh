@@ -0,0 +1,181 @@
+#pragma once
+#include "delay.h"
+#include "drivers/rcc.hh"
+#include "mmu.h"
+#include "stm32mp1xx.h"
+#include <algorithm>
+#include <cstdint>
+
+// CRC1 peripheral, set up to compute the same CRC-32 as crc32():
+// polynomial 0x04C11DB7, initial value 0xFFFFFFFF, input and output bit-reversed,
+// and the output inverted.
+//
+// Large buffers are written to the CRC data register by an MDMA channel, so add()
+// returns right away and the CPU is free while the CRC is calculated. Bytes that
+// are not part of an aligned word, or don't fit in one DMA transfer, are written
+// by the CPU, in order, before and after the DMA transfer.
+class HardwareCRC {
+	MDMA_Channel_TypeDef *dma;
+
+	bool dma_busy = false;
+	bool dma_error = false;
+	const uint8_t *tail = nullptr;
+	uint32_t tail_size = 0;
+
+public:
+	// Below this, it's faster for the CPU to write the words
+	static constexpr uint32_t MinDMASize = 256;
+
+	// BNDT is 17 bits, BRC is 12 bits
+	static constexpr uint32_t MaxBlockSize = 64 * 1024;
+	static constexpr uint32_t MaxBlocks = 4096;
+
+	HardwareCRC(MDMA_Channel_TypeDef *channel = MDMA_Channel1)
+		: dma{channel}
+	{
+		mdrivlib::RCC_Enable::CRC1_::set();
+		mdrivlib::RCC_Enable::MDMA_::set();
+		reset();
+	}
+
+	void reset()
+	{
+		finish();
+		dma_error = false;
+		CRC1->POL = 0x04C11DB7;
+		CRC1->INIT = 0xFFFFFFFF;
+		CRC1->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT | CRC_CR_RESET;
+	}
+
+	// The buffer must not be modified until the next call to add(), value() or reset()
+	void add(const uint8_t *buf, uint32_t size)
+	{
+		finish();
+
+		while (size && (reinterpret_cast<uint32_t>(buf) & 3)) {
+			write_byte(*buf++);
+			size--;
+		}
+
+		uint32_t dma_bytes = (size >= MinDMASize) ? start_dma(buf, size & ~3) : 0;
+		if (dma_bytes) {
+			// The rest must wait until the DMA is done
+			tail = buf + dma_bytes;
+			tail_size = size - dma_bytes;
+			return;
+		}
+
+		write_cpu(buf, size);
+	}
+
+	// Waits for the DMA (if running) and returns the CRC of everything added
+	uint32_t value()
+	{
+		finish();
+		return ~CRC1->DR;
+	}
+
+	// False if a DMA transfer failed since the last reset(), so value() is not valid
+	bool ok() const { return !dma_error; }
+
+private:
+	// A whole transfer is waited for at once, so allow for a large one
+	static constexpr uint32_t DMATimeout_us = 1000000;
+
+	// Input bit reversal is done per word for word writes (bytes are little-endian),
+	// but must be per byte for byte writes
+	void write_byte(uint8_t byte)
+	{
+		CRC1->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+		*reinterpret_cast<volatile uint8_t *>(&CRC1->DR) = byte;
+		CRC1->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT;
+	}
+
+	// buf must be word-aligned
+	void write_cpu(const uint8_t *buf, uint32_t size)
+	{
+		auto *w = reinterpret_cast<const uint32_t *>(buf);
+		for (; size >= 4; size -= 4)
+			CRC1->DR = *w++;
+
+		buf = reinterpret_cast<const uint8_t *>(w);
+		while (size--)
+			write_byte(*buf++);
+	}
+
+	// Starts the DMA on as much of the buffer as fits in one repeated block transfer.
+	// Returns the number of bytes it will write.
+	uint32_t start_dma(const uint8_t *buf, uint32_t size)
+	{
+		uint32_t block_size = size;
+		uint32_t num_blocks = 1;
+		if (size > MaxBlockSize) {
+			block_size = MaxBlockSize;
+			num_blocks = std::min(size / MaxBlockSize, MaxBlocks);
+			size = block_size * num_blocks;
+		}
+
+		// The MDMA reads from memory, not from the caches
+		dcache_clean_range(reinterpret_cast<uint32_t>(buf), size);
+
+		dma->CCR = 0;
+		while (dma->CCR & MDMA_CCR_EN)
+			;
+		clear_flags();
+
+		// Word accesses, source incrementing in 16-beat bursts, destination fixed.
+		// The whole repeated block transfer is triggered by one software request.
+		dma->CTCR = (2 << MDMA_CTCR_SINC_Pos) | (0 << MDMA_CTCR_DINC_Pos) | (2 << MDMA_CTCR_SSIZE_Pos) |
+					(2 << MDMA_CTCR_DSIZE_Pos) | (2 << MDMA_CTCR_SINCOS_Pos) | (4 << MDMA_CTCR_SBURST_Pos) |
+					(0 << MDMA_CTCR_DBURST_Pos) | (63 << MDMA_CTCR_TLEN_Pos) | (2 << MDMA_CTCR_TRGM_Pos) |
+					MDMA_CTCR_SWRM | MDMA_CTCR_BWM;
+
+		dma->CBNDTR = (block_size << MDMA_CBNDTR_BNDT_Pos) | ((num_blocks - 1) << MDMA_CBNDTR_BRC_Pos);
+		dma->CBRUR = 0;
+		dma->CLAR = 0;
+		dma->CTBR = 0; // AXI for source and dest
+		dma->CSAR = reinterpret_cast<uint32_t>(buf);
+		dma->CDAR = reinterpret_cast<uint32_t>(&CRC1->DR);
+
+		dma->CCR = (2 << MDMA_CCR_PL_Pos) | MDMA_CCR_EN;
+		dma->CCR = dma->CCR | MDMA_CCR_SWRQ;
+
+		dma_busy = true;
+		return size;
+	}
+
+	// Wait for the DMA transfer (if any), then write the bytes after it
+	void finish()
+	{
+		while (dma_busy) {
+			auto deadline = deadline_us(DMATimeout_us);
+			while (!(dma->CISR & (MDMA_CISR_CTCIF | MDMA_CISR_TEIF))) {
+				if (deadline_passed(deadline)) {
+					dma_error = true;
+					break;
+				}
+			}
+			if (dma->CISR & MDMA_CISR_TEIF)
+				dma_error = true;
+
+			dma->CCR = 0;
+			clear_flags();
+			dma_busy = false;
+
+			// What didn't fit in one transfer
+			if (!dma_error && tail_size >= MinDMASize) {
+				uint32_t dma_bytes = start_dma(tail, tail_size & ~3);
+				tail += dma_bytes;
+				tail_size -= dma_bytes;
+			}
+		}
+
+		write_cpu(tail, tail_size);
+		tail_size = 0;
+	}
+
+	void clear_flags()
+	{
+		dma->CIFCR = MDMA_CIFCR_CTEIF | MDMA_CIFCR_CCTCIF | MDMA_CIFCR_CBRTIF | MDMA_CIFCR_CBTIF | MDMA_CIFCR_CLTCIF;
+	}
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include "stm32mp1xx.h"
+#include <cstdint>
+
+// Cortex-A7 PMU cycle counter (PMCCNTR), counts MPU clock cycles.
+// 32-bit: wraps after about 6.6 seconds at 650MHz
+struct CycleCounter {
+	static void init()
+	{
+		uint32_t pmcr;
+		__get_CP(15, 0, pmcr, 9, 12, 0);
+		// E: enable counters, C: reset cycle counter
+		pmcr |= (1 << 0) | (1 << 2);
+		__set_CP(15, 0, pmcr, 9, 12, 0);
+
+		// PMCNTENSET: enable the cycle counter
+		__set_CP(15, 0, 1UL << 31, 9, 12, 1);
+		__ISB();
+	}
+
+	static uint32_t read()
+	{
+		uint32_t cycles;
+		__get_CP(15, 0, cycles, 9, 13, 0);
+		return cycles;
+	}
+};
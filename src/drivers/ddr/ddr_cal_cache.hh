@@ -0,0 +1,112 @@
+#pragma once
+#include "asm/io.h"
+#include "crc/crc32.hh"
+#include "drivers/bkpsram.hh"
+#include "stm32mp1_ddr.h"
+#include "stm32mp1_ddr_regs.h"
+#include "stm32mp1xx.h"
+#include <cstddef>
+#include <cstdint>
+
+// Remembers the results of the DQS gate training in the backup SRAM, so that after a
+// warm reset the PHY can be programmed with them instead of training again.
+// The values are only used if the DDR config is the one they were trained with, and
+// the reset didn't remove power (the board is at about the same voltage and temperature).
+struct DDRCalibrationCache {
+	static constexpr uint32_t Magic = 0x4C414344; // "DCAL"
+
+	// Changes if anything that affects the training changes
+	static uint32_t config_id(const stm32mp1_ddr_config &config)
+	{
+		CRC32::Checksum crc;
+		add(crc, config.info.speed);
+		add(crc, config.info.size);
+		add(crc, config.c_reg);
+		add(crc, config.c_timing);
+		add(crc, config.c_map);
+		add(crc, config.c_perf);
+		add(crc, config.p_reg);
+		add(crc, config.p_timing);
+		return crc.value();
+	}
+
+	// Fills cal with the values trained for this config, if there are some
+	static bool load(uint32_t config_id, stm32mp1_ddrphy_cal &cal)
+	{
+		BackupSRAM::init();
+		auto &c = cache();
+		if (c.magic != Magic || c.crc != checksum(c) || c.config_id != config_id)
+			return false;
+
+		copy_words(&cal, &c.cal);
+		return true;
+	}
+
+	static void store(uint32_t config_id, const stm32mp1_ddrphy_cal &cal)
+	{
+		BackupSRAM::init();
+		auto &c = cache();
+		c.magic = Magic;
+		c.config_id = config_id;
+		copy_words(&c.cal, &cal);
+		c.crc = checksum(c);
+	}
+
+	static void clear()
+	{
+		BackupSRAM::init();
+		cache().magic = 0;
+	}
+
+	// The values the PHY has after training
+	static stm32mp1_ddrphy_cal read_phy(stm32mp1_ddrphy *phy)
+	{
+		stm32mp1_ddrphy_cal cal;
+		cal.dx0dllcr = readl(&phy->dx0dllcr);
+		cal.dx0dqtr = readl(&phy->dx0dqtr);
+		cal.dx0dqstr = readl(&phy->dx0dqstr);
+		cal.dx1dllcr = readl(&phy->dx1dllcr);
+		cal.dx1dqtr = readl(&phy->dx1dqtr);
+		cal.dx1dqstr = readl(&phy->dx1dqstr);
+		cal.dx2dllcr = readl(&phy->dx2dllcr);
+		cal.dx2dqtr = readl(&phy->dx2dqtr);
+		cal.dx2dqstr = readl(&phy->dx2dqstr);
+		cal.dx3dllcr = readl(&phy->dx3dllcr);
+		cal.dx3dqtr = readl(&phy->dx3dqtr);
+		cal.dx3dqstr = readl(&phy->dx3dqstr);
+		return cal;
+	}
+
+private:
+	struct Data {
+		uint32_t magic;
+		uint32_t config_id;
+		stm32mp1_ddrphy_cal cal;
+		uint32_t crc; // Of everything above
+	};
+
+	static Data &cache() { return BackupSRAM::at<Data>(BackupSRAM::DDRCalibrationOffset); }
+
+	static uint32_t checksum(const Data &c)
+	{
+		CRC32::Checksum crc;
+		crc.add(reinterpret_cast<const uint8_t *>(&c), offsetof(Data, crc));
+		return crc.value();
+	}
+
+	template<typename T>
+	static void add(CRC32::Checksum &crc, const T &t)
+	{
+		crc.add(reinterpret_cast<const uint8_t *>(&t), sizeof t);
+	}
+
+	// Word by word: the MMU is off, so the backup SRAM is Strongly-ordered memory
+	__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void
+	copy_words(stm32mp1_ddrphy_cal *dst, const stm32mp1_ddrphy_cal *src)
+	{
+		auto d = reinterpret_cast<volatile uint32_t *>(dst);
+		auto s = reinterpret_cast<const volatile uint32_t *>(src);
+		for (uint32_t i = 0; i < sizeof(stm32mp1_ddrphy_cal) / 4; i++)
+			d[i] = s[i];
+	}
+};
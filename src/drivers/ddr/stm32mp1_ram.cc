@@ -4,7 +4,9 @@
  */
 
 #include "asm/io.h"
+#include "ddr_cal_cache.hh"
 #include "drivers/rcc.hh"
+#include "drivers/reset_flags.hh"
 #include "memsize.h"
 #include "print_messages.hh"
 #include "stm32mp15-osd32mp1-ddr3-1x4Gb.dtsi"
@@ -46,6 +48,59 @@ int stm32mp1_ddr_clk_enable(struct ddr_info *priv, u32 mem_speed)
 	return 0;
 }
 
+static void stm32mp1_ddr_start(struct ddr_info *priv, const struct stm32mp1_ddr_config *config)
+{
+	// Set CKMOD bits = 0b000 during init: "Normal mode: This mode must be selected during DDRC and DDRPHYC
+	// initialization phase"
+	RCC->DDRITFCR = (RCC->DDRITFCR & ~RCC_DDRITFCR_DDRCKMOD_Msk) | (0 << RCC_DDRITFCR_DDRCKMOD_Pos);
+
+	// Disable AXIDCG clock gating during init
+	RCC->DDRITFCR = RCC->DDRITFCR & ~RCC_DDRITFCR_AXIDCGEN;
+
+	stm32mp1_ddr_init(priv, config);
+
+	// Enable clock gating
+	RCC->DDRITFCR = RCC->DDRITFCR | RCC_DDRITFCR_AXIDCGEN;
+}
+
+// Walks a 1 and a 0 across the data bus, in bursts that use all the byte lanes.
+// Wrong DQS gate timings fail this right away.
+static bool stm32mp1_ddr_databus_ok(u32 base)
+{
+	volatile u32 *addr = (volatile u32 *)base;
+	for (u32 bit = 0; bit < 32; bit++) {
+		for (u32 i = 0; i < 8; i += 2) {
+			addr[i] = 1U << bit;
+			addr[i + 1] = ~(1U << bit);
+		}
+		for (u32 i = 0; i < 8; i += 2) {
+			if (addr[i] != (1U << bit) || addr[i + 1] != ~(1U << bit))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool stm32mp1_ddr_check(struct ddr_info *priv, const struct stm32mp1_ddr_config *config)
+{
+	/* check size */
+	debug("get_ram_size(", Hex{(u32)priv->info.base}, ", ", Hex{(u32)DDR_MEM_SIZE}, ")\n");
+	priv->info.size = get_ram_size((long *)priv->info.base, DDR_MEM_SIZE);
+	debug(Hex{(u32)priv->info.size}, "\n");
+
+	/* check memory access for all memory */
+	if (config->info.size != priv->info.size) {
+		pr_err("DDR invalid size : 0x", Hex{(u32)priv->info.size}, ", expected 0x", Hex{(u32)config->info.size}, "\n");
+		return false;
+	}
+
+	if (!stm32mp1_ddr_databus_ok(priv->info.base)) {
+		pr_err("DDR data bus test failed\n");
+		return false;
+	}
+	return true;
+}
+
 int stm32mp1_ddr_setup()
 {
 	struct ddr_info _priv;
@@ -61,30 +116,33 @@ int stm32mp1_ddr_setup()
 	priv->info.size = 0;
 
 	stm32mp1_ddr_get_config(&config);
-	config.p_cal_present = false;
 
-	// Set CKMOD bits = 0b000 during init: "Normal mode: This mode must be selected during DDRC and DDRPHYC
-	// initialization phase"
-	RCC->DDRITFCR = (RCC->DDRITFCR & ~RCC_DDRITFCR_DDRCKMOD_Msk) | (0 << RCC_DDRITFCR_DDRCKMOD_Pos);
+	// The DQS gate training is skipped after a warm reset, if it was done on a previous boot
+	const uint32_t config_id = DDRCalibrationCache::config_id(config);
+	config.p_cal_present = ResetFlags::is_warm_reset() && DDRCalibrationCache::load(config_id, config.p_cal);
 
-	// Disable AXIDCG clock gating during init
-	RCC->DDRITFCR = RCC->DDRITFCR & ~RCC_DDRITFCR_AXIDCGEN;
+	stm32mp1_ddr_start(priv, &config);
 
-	stm32mp1_ddr_init(priv, &config);
+	if (config.p_cal_present) {
+		if (stm32mp1_ddr_check(priv, &config)) {
+			log("DDR: used stored calibration\n");
+			return 0;
+		}
 
-	// Enable clock gating
-	RCC->DDRITFCR = RCC->DDRITFCR | RCC_DDRITFCR_AXIDCGEN;
-
-	/* check size */
-	debug("get_ram_size(", Hex{(u32)priv->info.base}, ", ", Hex{(u32)DDR_MEM_SIZE}, ")\n");
-	priv->info.size = get_ram_size((long *)priv->info.base, DDR_MEM_SIZE);
-	debug(Hex{(u32)priv->info.size}, "\n");
+		log("DDR: stored calibration failed, training again\n");
+		DDRCalibrationCache::clear();
+		config.p_cal_present = false;
+		stm32mp1_ddr_start(priv, &config);
+	}
 
-	/* check memory access for all memory */
-	if (config.info.size != priv->info.size) {
-		pr_err("DDR invalid size : 0x", Hex{(u32)priv->info.size}, ", expected 0x", Hex{(u32)config.info.size}, "\n");
+	if (!stm32mp1_ddr_check(priv, &config))
 		return -EINVAL;
-	}
+
+	if (readl(&priv->phy->pgsr) & (DDRPHYC_PGSR_DTERR | DDRPHYC_PGSR_DTIERR))
+		log("DDR: training had errors, not storing calibration\n");
+	else
+		DDRCalibrationCache::store(config_id, DDRCalibrationCache::read_phy(priv->phy));
+
 	return 0;
 }
 
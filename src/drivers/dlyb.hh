@@ -0,0 +1,90 @@
+#pragma once
+#include "stm32mp1xx.h"
+#include <cstdint>
+
+// Delay block (DLYB): a line of delay cells that shifts a peripheral's receive
+// (sampling) clock. calibrate() sizes the cells so that the line covers one
+// period of the clock it's fed with, and counts how many output phases fit in
+// that period. set_phase() then picks one of them.
+// The clock must be running at its final frequency when calibrating.
+class DelayBlock {
+	DLYB_TypeDef *dlyb;
+	uint32_t num_phases = 0;
+
+public:
+	static constexpr uint32_t MaxPhases = 12;
+
+	DelayBlock(DLYB_TypeDef *dlyb_instance)
+		: dlyb{dlyb_instance}
+	{}
+
+	// Returns false if no cell delay makes the line cover exactly one period
+	// (for example, the clock is too slow for the line)
+	bool calibrate()
+	{
+		dlyb->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+
+		// Use all 12 cells, and find the smallest cell delay that gives a full period
+		for (uint32_t unit = 0; unit < 128; unit++) {
+			dlyb->CFGR = (12 << DLYB_CFGR_SEL_Pos) | (unit << DLYB_CFGR_UNIT_Pos);
+
+			uint32_t timeout = 0xFFFF;
+			while (!(dlyb->CFGR & DLYB_CFGR_LNGF)) {
+				if (--timeout == 0)
+					break;
+			}
+
+			// LNG is which cell outputs are in the second half of the period:
+			// we want a rising edge somewhere in the line, but not at the last two cells.
+			uint32_t lng = (dlyb->CFGR & DLYB_CFGR_LNG) >> DLYB_CFGR_LNG_Pos;
+			if (lng != 0 && lng < 0xC00) {
+				// The last set bit of LNG[10:0] is the last cell that's within one period
+				num_phases = 11;
+				while (num_phases > 1 && !(lng & (1 << (num_phases - 1))))
+					num_phases--;
+
+				dlyb->CR = DLYB_CR_DEN;
+				return true;
+			}
+		}
+
+		disable();
+		return false;
+	}
+
+	uint32_t phases() const { return num_phases; }
+
+	void set_phase(uint32_t phase)
+	{
+		dlyb->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+		dlyb->CFGR = (dlyb->CFGR & ~(DLYB_CFGR_SEL | DLYB_CFGR_LNGF)) | (phase << DLYB_CFGR_SEL_Pos);
+		dlyb->CR = DLYB_CR_DEN;
+	}
+
+	void disable()
+	{
+		dlyb->CR = 0;
+		num_phases = 0;
+	}
+
+	// Finds the longest run of passing settings and returns the one in its centre.
+	// Returns -1 if none passed.
+	static int window_centre(const bool *pass, uint32_t num)
+	{
+		uint32_t best_start = 0;
+		uint32_t best_len = 0;
+		uint32_t start = 0;
+
+		for (uint32_t i = 0; i <= num; i++) {
+			if (i < num && pass[i])
+				continue;
+			if (i - start > best_len) {
+				best_start = start;
+				best_len = i - start;
+			}
+			start = i + 1;
+		}
+
+		return best_len ? static_cast<int>(best_start + best_len / 2) : -1;
+	}
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include "drivers/rcc.hh"
+#include "stm32mp1xx.h"
+#include <cstdint>
+
+// Cortex-A7 generic timer: the physical count (CNTPCT) is the system counter
+// of the STGEN, which counts from when it's enabled (by the BOOTROM, shortly after
+// power-on), so it keeps counting across stages and MPU clock changes.
+// 64-bit: never wraps. Differences of 32 bits wrap after about 178 seconds at 24MHz.
+struct GenericTimer {
+	// Makes sure the STGEN is counting and CNTFRQ holds its frequency.
+	// hse_hz is only used if the STGEN runs from HSE and nothing set its frequency.
+	static void init(uint32_t hse_hz)
+	{
+		mdrivlib::RCC_Enable::STGEN_::set();
+
+		// STGENSRC 2 and 3 are no clock: use HSI
+		if ((RCC->STGENCKSELR & RCC_STGENCKSELR_STGENSRC) > 1)
+			RCC->STGENCKSELR = 0;
+
+		if (STGENC->CNTFID0 == 0)
+			STGENC->CNTFID0 = source_clock_hz(hse_hz);
+
+		// EN: start counting, from the current value
+		if (!(STGENC->CNTCR & 1))
+			STGENC->CNTCR = 1;
+
+		__set_CNTFRQ(STGENC->CNTFID0);
+		__ISB();
+	}
+
+	static uint64_t ticks()
+	{
+		__ISB();
+		return __get_CNTPCT();
+	}
+
+	static uint32_t frequency() { return __get_CNTFRQ(); }
+
+	static uint32_t ticks_per_us() { return frequency() / 1000000; }
+
+	static uint32_t ticks_to_us(uint32_t ticks) { return ticks / ticks_per_us(); }
+
+private:
+	static uint32_t source_clock_hz(uint32_t hse_hz)
+	{
+		if (RCC->STGENCKSELR & RCC_STGENCKSELR_STGENSRC)
+			return hse_hz;
+		return 64000000 >> (RCC->HSICFGR & RCC_HSICFGR_HSIDIV);
+	}
+};
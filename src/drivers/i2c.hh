@@ -1,4 +1,5 @@
 #pragma once
+#include "delay.h"
 #include "drivers/i2c_conf.hh"
 #include "drivers/pinconf.hh"
 #include "drivers/rcc.hh"
@@ -156,23 +157,33 @@ private:
 		return true;
 	}
 
-	bool wait_on_flag_high_or_timeout(uint32_t flag, uint32_t timeout = 0xFFFFFF)
+	// Longest a byte (or the bus) can take, including clock stretching (same as the HAL's I2C_TIMEOUT_BUSY)
+	static constexpr uint32_t DefaultTimeout_us = 25000;
+
+	bool wait_on_flag_high_or_timeout(uint32_t flag, uint32_t timeout_us = DefaultTimeout_us)
 	{
-		while (!(i2c->ISR & flag) && timeout--)
-			;
-		return (timeout > 0) ? true : false;
+		auto deadline = deadline_us(timeout_us);
+		while (!(i2c->ISR & flag)) {
+			if (deadline_passed(deadline))
+				return false;
+		}
+		return true;
 	}
 
-	bool wait_not_busy(uint32_t timeout = 0xFFFFFF)
+	bool wait_not_busy(uint32_t timeout_us = DefaultTimeout_us)
 	{
-		while ((i2c->ISR & I2C_ISR_BUSY) && timeout--)
-			;
-		return (timeout > 0) ? true : false;
+		auto deadline = deadline_us(timeout_us);
+		while (i2c->ISR & I2C_ISR_BUSY) {
+			if (deadline_passed(deadline))
+				return false;
+		}
+		return true;
 	}
 
-	bool wait_on_flag_or_ack_or_timeout(uint32_t flag, uint32_t timeout = 0xFFFFFF)
+	bool wait_on_flag_or_ack_or_timeout(uint32_t flag, uint32_t timeout_us = DefaultTimeout_us)
 	{
-		while (timeout--) {
+		auto deadline = deadline_us(timeout_us);
+		while (!deadline_passed(deadline)) {
 			uint32_t isr = i2c->ISR;
 			if (isr & flag)
 				return true;
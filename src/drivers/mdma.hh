@@ -0,0 +1,159 @@
+#pragma once
+#include "delay.h"
+#include "drivers/rcc.hh"
+#include "mmu.h"
+#include "stm32mp1xx.h"
+#include <algorithm>
+#include <cstdint>
+
+// Memory-to-memory copy using one MDMA channel, polled.
+// The copy is done as a repeated block transfer: one block per chunk. As each
+// chunk completes, chunk_done(addr, size) is called while the MDMA carries on
+// with the next chunk. If chunk_done() is slower than the MDMA, it's called for
+// each finished chunk in turn. Source and destination must be 8-byte aligned.
+class MDMACopy {
+	MDMA_Channel_TypeDef *ch;
+
+public:
+	// BNDT is 17 bits, BRC is 12 bits
+	static constexpr uint32_t MaxChunkSize = 64 * 1024;
+	static constexpr uint32_t MaxChunksPerTransfer = 4096;
+
+	MDMACopy(MDMA_Channel_TypeDef *channel = MDMA_Channel0)
+		: ch{channel}
+	{
+		mdrivlib::RCC_Enable::MDMA_::set();
+	}
+
+	template<typename ChunkCallback>
+	bool copy(uint32_t dst, uint32_t src, uint32_t size, ChunkCallback &&chunk_done)
+	{
+		if ((dst | src) & 0x7)
+			return false;
+
+		// MDMA writes behind the caches' back
+		dcache_clean_invalidate_range(dst, size);
+
+		// Block sizes must be a multiple of the doubleword accesses: the CPU copies the last few bytes
+		uint32_t tail = size & 0x7;
+		size -= tail;
+
+		while (size) {
+			uint32_t num_chunks = std::min(size / MaxChunkSize, MaxChunksPerTransfer);
+			uint32_t chunk_size = MaxChunkSize;
+			if (num_chunks == 0) {
+				num_chunks = 1;
+				chunk_size = size;
+			}
+
+			if (!transfer(dst, src, chunk_size, num_chunks, chunk_done))
+				return false;
+
+			uint32_t bytes = chunk_size * num_chunks;
+			dst += bytes;
+			src += bytes;
+			size -= bytes;
+		}
+
+		if (tail) {
+			auto *d = reinterpret_cast<uint8_t *>(dst);
+			auto *s = reinterpret_cast<const uint8_t *>(src);
+			for (uint32_t i = 0; i < tail; i++)
+				d[i] = s[i];
+			chunk_done(dst, tail);
+		}
+		return true;
+	}
+
+	bool copy(uint32_t dst, uint32_t src, uint32_t size)
+	{
+		return copy(dst, src, size, [](uint32_t, uint32_t) {});
+	}
+
+private:
+	// Much longer than a 64kB chunk takes, even from slow memory
+	static constexpr uint32_t ChunkTimeout_us = 100000;
+
+	template<typename ChunkCallback>
+	bool transfer(uint32_t dst, uint32_t src, uint32_t chunk_size, uint32_t num_chunks, ChunkCallback &&chunk_done)
+	{
+		ch->CCR = 0;
+		while (ch->CCR & MDMA_CCR_EN)
+			;
+		clear_flags();
+
+		// Doubleword accesses, incrementing, 16-beat bursts on both sides (128B per buffer).
+		// The whole repeated block transfer is triggered by one software request.
+		ch->CTCR = (2 << MDMA_CTCR_SINC_Pos) | (2 << MDMA_CTCR_DINC_Pos) | (3 << MDMA_CTCR_SSIZE_Pos) |
+				   (3 << MDMA_CTCR_DSIZE_Pos) | (3 << MDMA_CTCR_SINCOS_Pos) | (3 << MDMA_CTCR_DINCOS_Pos) |
+				   (4 << MDMA_CTCR_SBURST_Pos) | (4 << MDMA_CTCR_DBURST_Pos) | (127 << MDMA_CTCR_TLEN_Pos) |
+				   (2 << MDMA_CTCR_TRGM_Pos) | MDMA_CTCR_SWRM | MDMA_CTCR_BWM;
+
+		ch->CBNDTR = (chunk_size << MDMA_CBNDTR_BNDT_Pos) | ((num_chunks - 1) << MDMA_CBNDTR_BRC_Pos);
+		ch->CBRUR = 0; // blocks are contiguous
+		ch->CLAR = 0;  // no linked list
+		ch->CTBR = 0;  // AXI for source and dest
+		ch->CSAR = src;
+		ch->CDAR = dst;
+
+		ch->CCR = (3 << MDMA_CCR_PL_Pos) | MDMA_CCR_EN;
+		ch->CCR = ch->CCR | MDMA_CCR_SWRQ;
+
+		uint32_t chunks_done = 0;
+		while (chunks_done < num_chunks) {
+			auto deadline = deadline_us(ChunkTimeout_us);
+			while (!(ch->CISR & (MDMA_CISR_BTIF | MDMA_CISR_CTCIF | MDMA_CISR_TEIF))) {
+				if (deadline_passed(deadline)) {
+					ch->CCR = 0;
+					clear_flags();
+					return false;
+				}
+			}
+
+			if (ch->CISR & MDMA_CISR_TEIF) {
+				ch->CCR = 0;
+				clear_flags();
+				return false;
+			}
+
+			ch->CIFCR = MDMA_CIFCR_CBTIF;
+
+			// BTIF doesn't count: if chunk_done() took longer than a block transfer,
+			// several chunks may have finished since the last time we got here
+			for (uint32_t finished = chunks_finished(num_chunks); chunks_done < finished; chunks_done++) {
+				uint32_t addr = dst + chunks_done * chunk_size;
+				dcache_invalidate_range(addr, chunk_size);
+				chunk_done(addr, chunk_size);
+			}
+		}
+
+		auto deadline = deadline_us(ChunkTimeout_us);
+		while (!(ch->CISR & (MDMA_CISR_CTCIF | MDMA_CISR_TEIF))) {
+			if (deadline_passed(deadline)) {
+				ch->CCR = 0;
+				clear_flags();
+				return false;
+			}
+		}
+		bool ok = !(ch->CISR & MDMA_CISR_TEIF);
+
+		ch->CCR = 0;
+		clear_flags();
+		return ok;
+	}
+
+	// BRC counts down the blocks that haven't started yet, so all blocks before the
+	// current one are done. Once the transfer is complete (CTCIF), they all are.
+	uint32_t chunks_finished(uint32_t num_chunks)
+	{
+		uint32_t not_started = (ch->CBNDTR & MDMA_CBNDTR_BRC_Msk) >> MDMA_CBNDTR_BRC_Pos;
+		if (ch->CISR & MDMA_CISR_CTCIF)
+			return num_chunks;
+		return num_chunks - 1 - not_started;
+	}
+
+	void clear_flags()
+	{
+		ch->CIFCR = MDMA_CIFCR_CTEIF | MDMA_CIFCR_CCTCIF | MDMA_CIFCR_CBRTIF | MDMA_CIFCR_CBTIF | MDMA_CIFCR_CLTCIF;
+	}
+};
@@ -0,0 +1,57 @@
+#include "qspi_benchmark.hh"
+#include "drivers/benchmark_report.hh"
+#include "drivers/cycle_counter.hh"
+#include "drivers/mdma.hh"
+#include "mmu.h"
+#include "print_messages.hh"
+#include "qspi_norflash_read.h"
+
+namespace QSPIBenchmark
+{
+
+// The byte-at-a-time loop that QSPI_read_MM() used to do.
+// Keep the compiler from turning it into a memcpy or vectorizing it.
+__attribute__((optimize("no-tree-loop-distribute-patterns", "no-tree-vectorize"))) static void
+copy_bytes(uint8_t *dst, const uint8_t *src, uint32_t num_bytes)
+{
+	while (num_bytes--)
+		*dst++ = *src++;
+}
+
+// Start each run with cold caches, so we measure the flash and not the cache
+static void flush(uint32_t flash_addr, uint8_t *dst, uint32_t size)
+{
+	dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(dst), size);
+	dcache_invalidate_range(QSPI_MEM_BASE + flash_addr, size);
+}
+
+void run(uint32_t flash_addr, uint8_t *dst, uint32_t size, uint32_t cpu_hz)
+{
+	CycleCounter::init();
+
+	flush(flash_addr, dst, size);
+	uint32_t start = CycleCounter::read();
+	copy_bytes(dst, reinterpret_cast<const uint8_t *>(QSPI_MEM_BASE + flash_addr), size);
+	uint32_t byte_cycles = CycleCounter::read() - start;
+
+	flush(flash_addr, dst, size);
+	start = CycleCounter::read();
+	QSPI_read_MM(dst, flash_addr, size);
+	uint32_t neon_cycles = CycleCounter::read() - start;
+
+	MDMACopy mdma;
+	flush(flash_addr, dst, size);
+	start = CycleCounter::read();
+	bool mdma_ok = mdma.copy(reinterpret_cast<uint32_t>(dst), QSPI_MEM_BASE + flash_addr, size);
+	uint32_t mdma_cycles = CycleCounter::read() - start;
+
+	print("QSPI memory-mapped read benchmark:\n");
+	report_throughput("  Byte loop: ", size, byte_cycles, cpu_hz);
+	report_throughput("  NEON copy: ", size, neon_cycles, cpu_hz);
+	if (mdma_ok)
+		report_throughput("  MDMA:      ", size, mdma_cycles, cpu_hz);
+	else
+		print("  MDMA:      failed\n");
+}
+
+} // namespace QSPIBenchmark
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+namespace QSPIBenchmark
+{
+// Compares memory-mapped read throughput of the byte loop, the NEON copy and the MDMA.
+// QSPI must already be initialized.
+void run(uint32_t flash_addr, uint8_t *dst, uint32_t size, uint32_t cpu_hz);
+} // namespace QSPIBenchmark
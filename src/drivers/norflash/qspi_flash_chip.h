@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+
+// Number of lines used for a phase of a command.
+// Values match the CCR IMODE/ADMODE/ABMODE/DMODE encoding.
+enum QSPILines {
+	QSPI_LINES_NONE = 0,
+	QSPI_LINES_1 = 1,
+	QSPI_LINES_2 = 2,
+	QSPI_LINES_4 = 3,
+};
+
+// A read command used for memory-mapped mode.
+// Examples:
+//   1-1-4: {.instruction = 0x6B, .instruction_lines = QSPI_LINES_1, .address_lines = QSPI_LINES_1,
+//           .address_bytes = 3, .data_lines = QSPI_LINES_4, .dummy_cycles = 8}
+//   1-4-4 with continuous read: {.instruction = 0xEB, .instruction_lines = QSPI_LINES_1,
+//           .address_lines = QSPI_LINES_4, .address_bytes = 3, .data_lines = QSPI_LINES_4,
+//           .alt_byte_lines = QSPI_LINES_4, .num_alt_bytes = 1, .alt_byte_value = 0xA0,
+//           .dummy_cycles = 4, .send_instruction_once = 1}
+typedef struct QSPIReadCmd {
+	uint8_t instruction;
+	uint8_t instruction_lines;
+	uint8_t address_lines;
+	uint8_t address_bytes; // 3 or 4
+	uint8_t data_lines;
+	uint8_t alt_byte_lines;
+	uint8_t num_alt_bytes; // 0 to 4. Often 1 byte of "mode bits"
+	uint32_t alt_byte_value;
+	uint8_t dummy_cycles;
+	uint8_t ddr; // DTR: address, alt bytes and data on both clock edges
+
+	// Send the instruction only for the first read (continuous read mode).
+	// The chip must be told to expect this, usually with the mode bits in the alt bytes
+	uint8_t send_instruction_once;
+} QSPIReadCmd;
+
+typedef struct QSPIFlashChip {
+	uint32_t size_bytes; // power of 2. Size of one chip, in dual-flash mode
+
+	// Two identical chips in parallel on banks 1 and 2 (dual-flash mode): each byte
+	// at offset N in the memory-mapped window comes from chip address N/2,
+	// flash 1 holding the even bytes and flash 2 the odd bytes.
+	uint8_t dual_flash;
+
+	uint8_t prescaler;		// QSPI clock = 266MHz / (prescaler + 1)
+	uint8_t sample_shift;	// Sample data a half-cycle late (must be 0 for DDR)
+	uint8_t cs_high_cycles; // Min nCS high time between commands, 1 to 8
+
+	// Commands sent (1-line, no address, no data) before entering memory-mapped mode.
+	// 0 means don't send
+	uint8_t enter_4byte_addr_cmd; // e.g. 0xB7, for 4-byte reads using 3-byte opcodes
+	uint8_t enter_qpi_cmd;		  // e.g. 0x35 or 0x38, for 4-4-4 reads
+
+	QSPIReadCmd read_cmd;
+} QSPIFlashChip;
@@ -1,4 +1,5 @@
 #include "qspi_ll.h"
+#include "delay.h"
 #include "stm32mp1xx.h"
 
 // TODO: To C++, use register_access.hh
@@ -27,12 +28,13 @@ void LL_QSPI_WaitNotBusy(void)
 
 uint32_t LL_QSPI_WaitFlagTimeout(uint32_t flag)
 {
-	// wait for flag to go high
-	uint32_t timeout = 0x00FFFFFF;
-	while (--timeout && ((QUADSPI->SR & flag) == 0)) {
-		;
+	// wait for flag to go high, for up to 100ms
+	deadline_t deadline = deadline_us(100000);
+	while ((QUADSPI->SR & flag) == 0) {
+		if (deadline_passed(deadline))
+			return 0;
 	}
-	return timeout;
+	return 1;
 }
 
 void LL_QSPI_WaitFlag(uint32_t flag)
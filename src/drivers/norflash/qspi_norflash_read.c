@@ -1,28 +1,32 @@
 #include "delay.h"
 #include "qspi_ll.h"
+#include "qspi_norflash_read.h"
 #include "stm32mp1xx.h"
 
-// TODO: Config file for QSPI chip:
-//  struct Cmd {
-//   u32 cmd;
-//   NumLines addr_lines;
-//   NumLines data_lines;
-//   NumLines altbyte_lines;
-//   u32 num_alt_bytes;
-//   u32 num_dummy_cycles;
-//   u32 alt_byte_value;
-// };
-// struct QSPIFlashChip {
-//   u32 chip_size_bytes;
-//   Cmd read_sio_cmd;
-//   Cmd read_quad_cmd;
-//   etc..
-// };
-
 #define QSPI_DUMMY_CYCLES_READ 0
 
-void QSPI_init()
+static uint32_t log2_ceil(uint32_t x)
+{
+	uint32_t bits = 0;
+	while ((1UL << bits) < x)
+		bits++;
+	return bits;
+}
+
+static uint32_t address_size(uint8_t address_bytes)
+{
+	return address_bytes == 4 ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS;
+}
+
+uint32_t QSPI_mapped_size(const QSPIFlashChip *chip)
 {
+	return chip->dual_flash ? chip->size_bytes * 2 : chip->size_bytes;
+}
+
+void QSPI_init(const QSPIFlashChip *chip)
+{
+	const QSPIReadCmd *cmd = &chip->read_cmd;
+
 	// Select ACLK 266MHz
 	RCC->QSPICKSELR = 0;
 
@@ -31,28 +35,86 @@ void QSPI_init()
 	RCC->AHB2RSTSETR = RCC_AHB6RSTSETR_QSPIRST;
 	RCC->AHB2RSTCLRR = RCC_AHB6RSTCLRR_QSPIRST;
 
-	// Prescale 3 = /4 --> 67MHz
 	// FIFO Threshold = 2 of 16
-	// Sample shift
-	QUADSPI->CR = (3 << QUADSPI_CR_PRESCALER_Pos) | (2 << QUADSPI_CR_FTHRES_Pos) | (QUADSPI_CR_SSHIFT) | QUADSPI_CR_EN;
+	QUADSPI->CR = (chip->prescaler << QUADSPI_CR_PRESCALER_Pos) | (2 << QUADSPI_CR_FTHRES_Pos) |
+				  (chip->sample_shift && !cmd->ddr ? QUADSPI_CR_SSHIFT : 0) |
+				  (chip->dual_flash ? QSPI_DUALFLASH_ENABLE : QSPI_DUALFLASH_DISABLE) | QUADSPI_CR_EN;
 
-	// RAM size 24-bits (16MByte), CS hold time of 2
-	QUADSPI->DCR = (23 << QUADSPI_DCR_FSIZE_Pos) | (2 << QUADSPI_DCR_CSHT_Pos);
+	// FSIZE: flash has 2^(FSIZE+1) bytes (both chips together, in dual-flash mode)
+	QUADSPI->DCR = ((log2_ceil(QSPI_mapped_size(chip)) - 1) << QUADSPI_DCR_FSIZE_Pos) |
+				   ((chip->cs_high_cycles - 1) << QUADSPI_DCR_CSHT_Pos);
+
+	// Chip mode changes are sent in SPI mode, so 4-byte addressing must be entered before QPI
+	if (chip->enter_4byte_addr_cmd)
+		LL_QSPI_SendInstructionNoDataNoAddress(chip->enter_4byte_addr_cmd);
+	if (chip->enter_qpi_cmd)
+		LL_QSPI_SendInstructionNoDataNoAddress(chip->enter_qpi_cmd);
+
+	LL_QSPI_WaitNotBusy();
 
 	// Enable MM mode:
-	const uint32_t dummy_cycles = 6;
-	LL_QSPI_SetCommConfig(QSPI_SIOO_INST_EVERY_CMD | QSPI_INSTRUCTION_1_LINE | QSPI_DATA_4_LINES |
-						  (dummy_cycles << QUADSPI_CCR_DCYC_Pos) | QSPI_ALTERNATE_BYTES_NONE |
-						  QSPI_ALTERNATE_BYTES_4_LINES | QSPI_ADDRESS_24_BITS | QSPI_ADDRESS_1_LINE |
-						  QUAD_OUT_FAST_READ_CMD | QSPI_FUNCTIONAL_MODE_MEMORY_MAPPED);
-	LL_QPSI_SetAltBytes(0x00);
+	uint32_t alt_bytes_size = cmd->num_alt_bytes ? ((cmd->num_alt_bytes - 1) << QUADSPI_CCR_ABSIZE_Pos) : 0;
+	LL_QSPI_SetCommConfig((cmd->ddr ? (QSPI_DDR_MODE_ENABLE | QSPI_DDR_HHC_HALF_CLK_DELAY) : QSPI_DDR_MODE_DISABLE) |
+						  (cmd->send_instruction_once ? QSPI_SIOO_INST_ONLY_FIRST_CMD : QSPI_SIOO_INST_EVERY_CMD) |
+						  (cmd->instruction_lines << QUADSPI_CCR_IMODE_Pos) |
+						  (cmd->address_lines << QUADSPI_CCR_ADMODE_Pos) | address_size(cmd->address_bytes) |
+						  ((cmd->num_alt_bytes ? cmd->alt_byte_lines : QSPI_LINES_NONE) << QUADSPI_CCR_ABMODE_Pos) |
+						  alt_bytes_size | (cmd->data_lines << QUADSPI_CCR_DMODE_Pos) |
+						  (cmd->dummy_cycles << QUADSPI_CCR_DCYC_Pos) | cmd->instruction |
+						  QSPI_FUNCTIONAL_MODE_MEMORY_MAPPED);
+	LL_QPSI_SetAltBytes(cmd->alt_byte_value);
 }
 
-uint32_t QSPI_read_MM(uint8_t *pData, uint32_t read_addr, uint32_t num_bytes)
+// Changes the clock prescaler and sample shift without resetting the peripheral
+// or the chip (which may be in QPI mode). Memory-mapped mode is restarted.
+void QSPI_set_clock(uint32_t prescaler, uint32_t sample_shift)
+{
+	uint32_t ccr = QUADSPI->CCR;
+
+	QUADSPI->CR |= QUADSPI_CR_ABORT;
+	while (QUADSPI->CR & QUADSPI_CR_ABORT)
+		;
+	LL_QSPI_WaitNotBusy();
+
+	uint32_t cr = QUADSPI->CR & ~(QUADSPI_CR_PRESCALER | QUADSPI_CR_SSHIFT);
+	QUADSPI->CR = cr | (prescaler << QUADSPI_CR_PRESCALER_Pos) | (sample_shift ? QUADSPI_CR_SSHIFT : 0);
+
+	QUADSPI->CCR = ccr;
+}
+
+// Copy using NEON 64-byte bursts. The source is aligned first so the loads
+// can use the :64 alignment hint; stores are byte-element so any destination
+// alignment works, even if the destination is strongly-ordered (MMU off).
+static void copy_neon(uint8_t *dst, const uint8_t *src, uint32_t num_bytes)
 {
-	uint8_t *src = (uint8_t *)(0x70000000U + read_addr);
+	while (num_bytes && ((uint32_t)src & 0x7)) {
+		*dst++ = *src++;
+		num_bytes--;
+	}
+
+	uint32_t num_bursts = num_bytes / 64;
+	if (num_bursts) {
+		asm volatile("1:							\n"
+					 "vld1.8 {d0-d3}, [%[src] :64]!	\n"
+					 "vld1.8 {d4-d7}, [%[src] :64]!	\n"
+					 "subs %[n], %[n], #1			\n"
+					 "vst1.8 {d0-d3}, [%[dst]]!		\n"
+					 "vst1.8 {d4-d7}, [%[dst]]!		\n"
+					 "bne 1b						\n"
+					 : [src] "+r"(src), [dst] "+r"(dst), [n] "+r"(num_bursts)
+					 :
+					 : "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "cc", "memory");
+	}
+
+	num_bytes &= 63;
 	while (num_bytes--)
-		*pData++ = *src++;
+		*dst++ = *src++;
+}
+
+uint32_t QSPI_read_MM(uint8_t *pData, uint32_t read_addr, uint32_t num_bytes)
+{
+	const uint8_t *src = (const uint8_t *)(QSPI_MEM_BASE + read_addr);
+	copy_neon(pData, src, num_bytes);
 
 	return 1;
 }
@@ -1,11 +1,16 @@
 #pragma once
+#include "qspi_flash_chip.h"
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void QSPI_init();
+void QSPI_init(const QSPIFlashChip *chip);
+void QSPI_set_clock(uint32_t prescaler, uint32_t sample_shift);
+
+// Size of the memory-mapped window that's backed by flash
+uint32_t QSPI_mapped_size(const QSPIFlashChip *chip);
 uint32_t QSPI_read_SIO(uint8_t *pData, uint32_t read_addr, uint32_t num_bytes);
 uint32_t QSPI_read_MM(uint8_t *pData, uint32_t read_addr, uint32_t num_bytes);
 uint32_t QSPI_read_quad(uint8_t *pData, uint32_t read_addr, uint32_t num_bytes);
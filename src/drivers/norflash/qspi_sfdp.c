@@ -0,0 +1,275 @@
+#include "qspi_sfdp.h"
+#include "qspi_ll.h"
+#include "stm32mp1xx.h"
+
+// JESD216 Serial Flash Discoverable Parameters
+
+#define SFDP_SIGNATURE 0x50444653 // "SFDP"
+#define SFDP_BFPT_ID 0xFF00
+#define SFDP_DUMMY_CYCLES 8
+#define SFDP_MAX_PRESCALER 5 // SFDP reads are only guaranteed up to 50MHz: 266MHz/6 = 44MHz
+
+// Basic Flash Parameter Table: we use the first 16 DWORDs
+#define BFPT_MAX_DWORDS 16
+#define BFPT_DWORD(n) (bfpt[(n)-1])
+
+#define WRITE_STATUS_REG2_CMD 0x31
+#define READ_STATUS_REG2_CMD 0x35
+#define WRITE_STATUS_REG2_ALT_CMD 0x3E
+#define READ_STATUS_REG2_ALT_CMD 0x3F
+#define WRITE_ENABLE_VOLATILE_SR_CMD 0x50
+
+#define BYTE_MODE_CCR (QSPI_INSTRUCTION_1_LINE | QSPI_DATA_1_LINE)
+
+static void abort_transfer(void)
+{
+	QUADSPI->CR = QUADSPI->CR | QUADSPI_CR_ABORT;
+	while (QUADSPI->CR & QUADSPI_CR_ABORT)
+		;
+	LL_QSPI_ClearFlag(QUADSPI_FCR_CTCF | QUADSPI_FCR_CTEF | QUADSPI_FCR_CSMF);
+}
+
+// Indirect read. If the command has an address phase, writing the address starts
+// the transfer, otherwise writing CCR does.
+static uint32_t indirect_read(uint32_t ccr, uint32_t addr, uint8_t *data, uint32_t len)
+{
+	LL_QSPI_WaitNotBusy();
+	LL_QPSI_SetDataLength(len);
+	LL_QSPI_SetCommConfig(ccr | QSPI_FUNCTIONAL_MODE_INDIRECT_READ);
+	if (ccr & QUADSPI_CCR_ADMODE)
+		LL_QSPI_SetAddress(addr);
+
+	while (len--) {
+		if (!LL_QSPI_WaitFlagTimeout(QUADSPI_SR_FTF | QUADSPI_SR_TCF))
+			return 0;
+		*data++ = *(volatile uint8_t *)(&QUADSPI->DR);
+	}
+
+	uint32_t ok = LL_QSPI_WaitFlagTimeout(QUADSPI_SR_TCF);
+	LL_QSPI_ClearFlag(QUADSPI_FCR_CTCF);
+	return ok;
+}
+
+static uint32_t indirect_write(uint32_t ccr, const uint8_t *data, uint32_t len)
+{
+	LL_QSPI_WaitNotBusy();
+	LL_QPSI_SetDataLength(len);
+	LL_QSPI_SetCommConfig(ccr | QSPI_FUNCTIONAL_MODE_INDIRECT_WRITE);
+
+	while (len--) {
+		if (!LL_QSPI_WaitFlagTimeout(QSPI_FLAG_FT))
+			return 0;
+		*(volatile uint8_t *)(&QUADSPI->DR) = *data++;
+	}
+
+	uint32_t ok = LL_QSPI_WaitFlagTimeout(QSPI_FLAG_TC);
+	LL_QSPI_ClearFlag(QUADSPI_FCR_CTCF);
+	return ok;
+}
+
+static uint32_t read_sfdp(uint32_t addr, void *data, uint32_t len)
+{
+	return indirect_read(BYTE_MODE_CCR | QSPI_ADDRESS_1_LINE | QSPI_ADDRESS_24_BITS |
+							 (SFDP_DUMMY_CYCLES << QUADSPI_CCR_DCYC_Pos) | READ_SERIAL_FLASH_DISCO_PARAM_CMD,
+						 addr,
+						 (uint8_t *)data,
+						 len);
+}
+
+static uint32_t read_reg(uint8_t cmd, uint8_t *val)
+{
+	return indirect_read(BYTE_MODE_CCR | cmd, 0, val, 1);
+}
+
+// Writes a status register. With volatile set, the write goes to the volatile copy
+// (enabled with 50h), which doesn't wear the flash and is lost at power-off.
+static uint32_t write_reg(uint8_t cmd, const uint8_t *vals, uint32_t len, uint32_t volatile_sr)
+{
+	if (volatile_sr) {
+		if (!LL_QSPI_SendInstructionNoDataNoAddress(WRITE_ENABLE_VOLATILE_SR_CMD))
+			return 0;
+	} else if (!LL_QSPI_WriteEnable())
+		return 0;
+
+	if (!indirect_write(BYTE_MODE_CCR | cmd, vals, len))
+		return 0;
+
+	// Wait for the write to finish (immediate for a volatile write)
+	LL_QSPI_StartAutoPoll(0, QSPI_SR_WIP, 0x10, QSPI_MATCH_MODE_AND);
+	uint32_t ok = LL_QSPI_WaitFlagTimeout(QSPI_FLAG_SM);
+	LL_QSPI_ClearFlag(QUADSPI_FCR_CSMF);
+	return ok;
+}
+
+// Sets the Quad Enable bit using the procedure in BFPT DWORD 15 bits 22:20.
+// The register is only written if QE is clear. If the chip has a volatile status register
+// (BFPT DWORD 16 bit 3), that's written instead of the non-volatile one, so booting never
+// wears the status register and a power loss during the write can't leave it half-written.
+static uint32_t set_quad_enable(uint32_t qer, uint32_t volatile_sr)
+{
+	uint8_t sr[2];
+
+	switch (qer) {
+		case 0: // No QE bit
+			return 1;
+
+		case 2: // QE is bit 6 of SR1, written with 01h (one byte)
+			if (!read_reg(READ_STATUS_REG_CMD, &sr[0]))
+				return 0;
+			if (sr[0] & (1 << 6))
+				return 1;
+			sr[0] |= (1 << 6);
+			return write_reg(WRITE_STATUS_REG_CMD, sr, 1, volatile_sr);
+
+		case 3: // QE is bit 7 of SR2, read with 3Fh and written with 3Eh
+			if (!read_reg(READ_STATUS_REG2_ALT_CMD, &sr[0]))
+				return 0;
+			if (sr[0] & (1 << 7))
+				return 1;
+			sr[0] |= (1 << 7);
+			return write_reg(WRITE_STATUS_REG2_ALT_CMD, sr, 1, volatile_sr);
+
+		case 1: // QE is bit 1 of SR2, written with SR1 by 01h (two bytes). There's no
+		case 4: // instruction to read SR2, so we can't tell if QE is already set.
+			// Only do the blind write if it's volatile; SR2's other bits end up 0 until power-off.
+			if (!volatile_sr)
+				return 0;
+			if (!read_reg(READ_STATUS_REG_CMD, &sr[0]))
+				return 0;
+			sr[1] = (1 << 1);
+			return write_reg(WRITE_STATUS_REG_CMD, sr, 2, volatile_sr);
+
+		case 5: // QE is bit 1 of SR2, read with 35h, written with SR1 by 01h (two bytes)
+			if (!read_reg(READ_STATUS_REG_CMD, &sr[0]) || !read_reg(READ_STATUS_REG2_CMD, &sr[1]))
+				return 0;
+			if (sr[1] & (1 << 1))
+				return 1;
+			sr[1] |= (1 << 1);
+			return write_reg(WRITE_STATUS_REG_CMD, sr, 2, volatile_sr);
+
+		case 6: // QE is bit 1 of SR2, read with 35h and written with 31h
+			if (!read_reg(READ_STATUS_REG2_CMD, &sr[0]))
+				return 0;
+			if (sr[0] & (1 << 1))
+				return 1;
+			sr[0] |= (1 << 1);
+			return write_reg(WRITE_STATUS_REG2_CMD, sr, 1, volatile_sr);
+
+		default:
+			return 0;
+	}
+}
+
+// Fills in a read command from a BFPT fast read descriptor:
+// 5 bits dummy cycles, 3 bits mode clocks, 8 bits instruction
+static void make_read_cmd(QSPIReadCmd *cmd, uint32_t desc, uint8_t addr_lines)
+{
+	uint32_t dummy = desc & 0x1F;
+	uint32_t mode_clocks = (desc >> 5) & 0x7;
+
+	cmd->instruction = (desc >> 8) & 0xFF;
+	cmd->instruction_lines = QSPI_LINES_1;
+	cmd->address_lines = addr_lines;
+	cmd->address_bytes = 3;
+	cmd->data_lines = QSPI_LINES_4;
+	cmd->ddr = 0;
+	cmd->send_instruction_once = 0;
+
+	// Mode bits are sent as an alt byte, if they fill a whole byte. 0xFF keeps
+	// the chip out of continuous read mode. Otherwise they're just dummy cycles.
+	uint32_t mode_bits = mode_clocks * (addr_lines == QSPI_LINES_4 ? 4 : 1);
+	if (mode_bits == 8) {
+		cmd->alt_byte_lines = addr_lines;
+		cmd->num_alt_bytes = 1;
+		cmd->alt_byte_value = 0xFF;
+	} else {
+		cmd->alt_byte_lines = QSPI_LINES_NONE;
+		cmd->num_alt_bytes = 0;
+		cmd->alt_byte_value = 0;
+		dummy += mode_clocks;
+	}
+	cmd->dummy_cycles = dummy;
+}
+
+static uint32_t detect(QSPIFlashChip *chip)
+{
+	uint32_t header[4]; // SFDP header and first parameter header (always the BFPT)
+	uint32_t bfpt[BFPT_MAX_DWORDS];
+
+	if (!read_sfdp(0, header, sizeof(header)) || header[0] != SFDP_SIGNATURE)
+		return 0;
+
+	uint32_t param_id = (header[2] & 0xFF) | ((header[3] >> 16) & 0xFF00);
+	uint32_t num_dwords = header[2] >> 24;
+	uint32_t table_addr = header[3] & 0x00FFFFFF;
+	if (param_id != SFDP_BFPT_ID || num_dwords < 9)
+		return 0;
+
+	if (num_dwords > BFPT_MAX_DWORDS)
+		num_dwords = BFPT_MAX_DWORDS;
+	if (!read_sfdp(table_addr, bfpt, num_dwords * 4))
+		return 0;
+
+	// Quad Enable requirements are only given in JESD216A and later (15+ DWORDs).
+	// Without them we can't safely use a quad read.
+	if (num_dwords < 15)
+		return 0;
+
+	// Density
+	uint32_t density = BFPT_DWORD(2);
+	uint32_t size_bytes;
+	if (density & 0x80000000) {
+		uint32_t n = density & 0x7FFFFFFF;
+		if (n < 3 || n > 34)
+			return 0;
+		size_bytes = 1UL << (n - 3);
+	} else
+		size_bytes = (density >> 3) + 1;
+
+	// Entering 4-byte address mode (or QPI mode) survives an MPU reset and would
+	// confuse the BOOTROM, so we don't do it here. The board conf can ask for it.
+	// Without it, only the first 16MB of a larger chip is reachable.
+	uint32_t addr_bytes = (BFPT_DWORD(1) >> 17) & 0x3;
+	uint32_t four_byte_only = (addr_bytes == 2);
+	if (!four_byte_only && size_bytes > 16 * 1024 * 1024)
+		size_bytes = 16 * 1024 * 1024;
+
+	QSPIReadCmd cmd;
+	if (BFPT_DWORD(1) & (1 << 21))
+		make_read_cmd(&cmd, BFPT_DWORD(3) & 0xFFFF, QSPI_LINES_4); // 1-4-4
+	else if (BFPT_DWORD(1) & (1 << 22))
+		make_read_cmd(&cmd, BFPT_DWORD(3) >> 16, QSPI_LINES_1); // 1-1-4
+	else
+		return 0;
+
+	if (four_byte_only)
+		cmd.address_bytes = 4;
+
+	// DWORD 16 bit 3: the status registers have volatile copies, written after a 50h write enable
+	uint32_t volatile_sr = num_dwords >= 16 && (BFPT_DWORD(16) & (1 << 3));
+	uint32_t qer = (BFPT_DWORD(15) >> 20) & 0x7;
+	if (!set_quad_enable(qer, volatile_sr))
+		return 0;
+
+	chip->size_bytes = size_bytes;
+	chip->enter_4byte_addr_cmd = 0;
+	chip->enter_qpi_cmd = 0;
+	chip->read_cmd = cmd;
+	return 1;
+}
+
+uint32_t QSPI_sfdp_detect(QSPIFlashChip *chip)
+{
+	abort_transfer();
+
+	uint32_t cr = QUADSPI->CR;
+	uint32_t prescaler = (cr & QUADSPI_CR_PRESCALER) >> QUADSPI_CR_PRESCALER_Pos;
+	if (prescaler < SFDP_MAX_PRESCALER)
+		MODIFY_REG(QUADSPI->CR, QUADSPI_CR_PRESCALER, SFDP_MAX_PRESCALER << QUADSPI_CR_PRESCALER_Pos);
+
+	uint32_t ok = detect(chip);
+
+	abort_transfer();
+	QUADSPI->CR = cr;
+	return ok;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "qspi_flash_chip.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reads the flash chip's JEDEC SFDP tables (in 1-1-1 mode) and updates chip with
+// the size and fastest quad read command it supports. Sets the Quad Enable bit if it's clear:
+// in the volatile status register if the chip has one, otherwise in the non-volatile one.
+// QSPI must already be initialized with QSPI_init().
+// Returns 0 if SFDP was not found or not usable, in which case chip is not modified.
+uint32_t QSPI_sfdp_detect(QSPIFlashChip *chip);
+
+#ifdef __cplusplus
+}
+#endif
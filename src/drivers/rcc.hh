@@ -288,6 +288,29 @@ using DitheringTPDFDisable = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_Typ
 } // namespace SpreadSpectrumClock
 } // namespace PLL2
 
+using PLL4Source = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, RCK4SELR), RCC_RCK4SELR_PLL4SRC>;
+enum {PLL4SourceHSI = 0, PLL4SourceHSE = 1, PLL4SourceCSI = 2, PLL4SourceI2SCKIN = 3};
+using PLL4SourceReady = RegisterBits<ReadOnly, RCC_BASE + offsetof(RCC_TypeDef, RCK4SELR), RCC_RCK4SELR_PLL4SRCRDY>;
+
+namespace PLL4 {
+using Enable = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CR), RCC_PLL4CR_PLLON>;
+using Ready = RegisterBits<ReadOnly, RCC_BASE + offsetof(RCC_TypeDef, PLL4CR), RCC_PLL4CR_PLL4RDY>;
+using DIVPEnable = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CR), RCC_PLL4CR_DIVPEN>;
+using DIVQEnable = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CR), RCC_PLL4CR_DIVQEN>;
+using DIVREnable = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CR), RCC_PLL4CR_DIVREN>;
+
+using DIVM4 = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR1), RCC_PLL4CFGR1_DIVM4>;
+using DIVN = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR1), RCC_PLL4CFGR1_DIVN>;
+using InputFreqRange = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR1), RCC_PLL4CFGR1_IFRGE>;
+using DIVP = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR2), RCC_PLL4CFGR2_DIVP>;
+using DIVQ = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR2), RCC_PLL4CFGR2_DIVQ>;
+using DIVR = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4CFGR2), RCC_PLL4CFGR2_DIVR>;
+using FRACValue = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4FRACR), RCC_PLL4FRACR_FRACV>;
+using FRACLatch = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, PLL4FRACR), RCC_PLL4FRACR_FRACLE>;
+} // namespace PLL4
+
+using SDMMC12ClockSrc = RegisterBits<ReadWrite, RCC_BASE + offsetof(RCC_TypeDef, SDMMC12CKSELR), RCC_SDMMC12CKSELR_SDMMC12SRC>;
+enum : uint32_t { SDMMC12ClockSrcHCLK6 = 0b000, SDMMC12ClockSrcPLL3R = 0b001, SDMMC12ClockSrcPLL4P = 0b010, SDMMC12ClockSrcHSI = 0b011 };
 
 //RCK12SELR
 //  clang-format on
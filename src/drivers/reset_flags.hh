@@ -0,0 +1,44 @@
+#pragma once
+#include "drivers/bkpsram.hh"
+#include "print_messages.hh"
+#include "stm32mp1xx.h"
+#include <cstdint>
+
+// The RCC reset flags (RCC_MP_RSTSCLRR) say what caused a reset, but they add up until
+// they're cleared. So the FSBL clears them on each boot, to know what caused this one,
+// and the app finds them cleared. Before that, the raw value is copied to the backup SRAM
+// for the app: at BKPSRAM_BASE + ResetFlagsOffset there's the magic number "RSTF", then the flags.
+struct ResetFlags {
+	static constexpr uint32_t Magic = 0x46545352; // "RSTF"
+
+	// Saves and clears the flags. Call once, early in main() (needs backup domain access)
+	static void read_and_clear()
+	{
+		flags = RCC->MP_RSTSCLRR;
+
+		BackupSRAM::init();
+		auto &saved = BackupSRAM::at<Data>(BackupSRAM::ResetFlagsOffset);
+		saved.magic = Magic;
+		saved.flags = flags;
+
+		RCC->MP_RSTSCLRR = flags;
+		debug("Reset flags: ", Hex{flags}, "\n");
+	}
+
+	// Of the flags read by read_and_clear(): power-on, brown-out, VDDCORE and
+	// Standby resets are cold, all others are warm.
+	static bool is_warm_reset()
+	{
+		constexpr uint32_t ColdResetFlags = RCC_MP_RSTSCLRR_PORRSTF | RCC_MP_RSTSCLRR_BORRSTF |
+											RCC_MP_RSTSCLRR_VCORERSTF | RCC_MP_RSTSCLRR_STDBYRSTF;
+		return (flags & ColdResetFlags) == 0;
+	}
+
+private:
+	struct Data {
+		uint32_t magic;
+		uint32_t flags;
+	};
+
+	static inline uint32_t flags = 0;
+};
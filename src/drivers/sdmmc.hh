@@ -0,0 +1,823 @@
+#pragma once
+#include "delay.h"
+#include "mmu.h"
+#include "stm32mp1xx.h"
+#include <algorithm>
+#include <cstdint>
+
+// Read-only SD card and eMMC driver for the SDMMC peripherals.
+// Commands and small reads are done by polling, large reads use the internal DMA (IDMA).
+// Multi-block reads use CMD23 (SET_BLOCK_COUNT) + CMD18 if the card supports it
+// (all eMMCs do), otherwise an open-ended CMD18 that's ended with CMD12.
+// Data timeouts are the peripheral's own (in card clock cycles). Everything else the CPU
+// waits for has a deadline in microseconds (deadline_us()).
+class SDMMC_Controller {
+	SDMMC_TypeDef *sdmmc;
+
+	uint32_t rca = 0;
+	bool high_capacity = false; // SDHC/SDXC: addressed in blocks, not bytes
+	bool supports_cmd23 = false;
+	uint32_t _num_blocks = 0;
+	uint32_t _last_status = 0;
+	bool _dma_overrun = false;
+	uint32_t _cid[4]{};
+
+public:
+	static constexpr uint32_t BlockSize = 512;
+
+	// DLEN is 25 bits wide
+	static constexpr uint32_t MaxBlocksPerRead = SDMMC_DLEN_DATALENGTH_Msk / BlockSize;
+
+	// In card clock cycles
+	static constexpr uint32_t DefaultDataTimeout = 0x04000000;
+
+	enum class CardState : uint32_t { Idle, Ready, Ident, Standby, Transfer, Data, Receive, Program, Disconnect, Error };
+
+	SDMMC_Controller(SDMMC_TypeDef *instance)
+		: sdmmc{instance}
+	{}
+
+	// Powers on and identifies the SD card, then selects it in 4-bit mode.
+	// The kernel clock must be 64MHz (HSI) for the 400kHz identification clock.
+	bool init()
+	{
+		power_up();
+		send_cmd(Cmd::GoIdle, 0, Response::None);
+
+		// CMD8 is only answered by version 2.0 cards, which can be high capacity
+		bool v2 = send_cmd(Cmd::SendIfCond, CheckPattern, Response::R7) && (sdmmc->RESP1 & 0xFFF) == CheckPattern;
+
+		uint32_t ocr = 0;
+		auto deadline = deadline_us(PowerUpTimeout_us);
+		while (!(ocr & OCR_PowerUpDone)) {
+			if (deadline_passed(deadline))
+				return false;
+			if (!send_app_cmd(Cmd::SDSendOpCond, VoltageWindow | (v2 ? OCR_HighCapacity : 0), Response::R3, 0))
+				return false;
+			ocr = sdmmc->RESP1;
+		}
+		high_capacity = ocr & OCR_HighCapacity;
+
+		if (!send_cmd(Cmd::AllSendCID, 0, Response::R2))
+			return false;
+
+		return identify_and_select();
+	}
+
+	// Powers on and identifies an eMMC, then selects it (1-bit bus, legacy timing).
+	// The EXT_CSD is read into ext_csd.
+	// The kernel clock must be 64MHz (HSI) for the 400kHz identification clock.
+	bool init_mmc(uint8_t (&ext_csd)[512])
+	{
+		power_up();
+		send_cmd(Cmd::GoIdle, 0, Response::None);
+
+		uint32_t ocr = 0;
+		auto deadline = deadline_us(PowerUpTimeout_us);
+		while (!(ocr & OCR_PowerUpDone)) {
+			if (deadline_passed(deadline))
+				return false;
+			if (!send_cmd(Cmd::MMCSendOpCond, MMCVoltageWindow | OCR_SectorMode, Response::R3))
+				return false;
+			ocr = sdmmc->RESP1;
+		}
+		high_capacity = (ocr & OCR_AccessModeMask) == OCR_SectorMode;
+
+		if (!send_cmd(Cmd::AllSendCID, 0, Response::R2))
+			return false;
+		save_cid();
+
+		// The host assigns the RCA of an eMMC
+		rca = 1;
+		if (!send_cmd(Cmd::MMCSetRelativeAddr, rca << 16, Response::R1))
+			return false;
+
+		if (!send_cmd(Cmd::SendCSD, rca << 16, Response::R2))
+			return false;
+		const uint32_t csd[4] = {sdmmc->RESP1, sdmmc->RESP2, sdmmc->RESP3, sdmmc->RESP4};
+
+		if (!send_cmd(Cmd::SelectCard, rca << 16, Response::R1b))
+			return false;
+
+		if (!read_register_data(Cmd::MMCSendExtCSD, 0, false, ext_csd))
+			return false;
+
+		// Devices over 2GB are sector addressed, and their size is SEC_COUNT
+		_num_blocks = high_capacity ? ext_csd[212] | (ext_csd[213] << 8) | (ext_csd[214] << 16) | (ext_csd[215] << 24) :
+									  capacity_from_csd(csd);
+		supports_cmd23 = true;
+		return true;
+	}
+
+	// Starts the eMMC boot operation: the device streams the boot partition that's
+	// enabled for boot (EXT_CSD PARTITION_CONFIG) without being identified.
+	// This is the alternative boot operation (CMD0 with the boot argument).
+	// bus_width and ack must match how the device was set up (EXT_CSD BOOT_BUS_CONDITIONS,
+	// PARTITION_CONFIG BOOT_ACK). The kernel clock must be 64MHz (HSI).
+	// Read the data with read_boot_data(), then call end_boot_operation().
+	bool start_boot_operation(uint32_t bus_width, bool ack)
+	{
+		power_up();
+		set_clock_div(BootClockDiv);
+		set_bus_width(bus_width);
+
+		// The device only starts a boot operation from pre-idle state
+		send_cmd(Cmd::GoIdle, GoPreIdleArg, Response::None);
+
+		// The length is not known yet: the transfer is ended by end_boot_operation()
+		start_data(MaxBlocksPerRead * BlockSize, DataBlockSize512, BootDataTimeout);
+		sdmmc->ACKTIME = BootAckTimeout;
+		if (ack)
+			sdmmc->DCTRL = sdmmc->DCTRL | SDMMC_DCTRL_BOOTACKEN;
+
+		sdmmc->ICR = CmdFlags;
+		sdmmc->ARG = AltBootArg;
+		sdmmc->CMD = Cmd::GoIdle | SDMMC_CMD_CMDTRANS | SDMMC_CMD_BOOTMODE | SDMMC_CMD_BOOTEN | SDMMC_CMD_CPSMEN;
+
+		auto deadline = deadline_us(CmdTimeout_us);
+		while (!(sdmmc->STA & SDMMC_STA_CMDSENT)) {
+			if (deadline_passed(deadline)) {
+				end_boot_operation();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Reads the next num_bytes (a multiple of 32) of the boot operation stream into dst,
+	// which must be word-aligned.
+	// The card clock stops while the FIFO is full, so the stream can be read in pieces.
+	bool read_boot_data(uint8_t *dst, uint32_t num_bytes)
+	{
+		constexpr uint32_t ErrorFlags = DataErrorFlags | SDMMC_STA_ACKFAIL | SDMMC_STA_ACKTIMEOUT | SDMMC_STA_DATAEND;
+		auto *dst32 = reinterpret_cast<uint32_t *>(dst);
+
+		for (uint32_t bursts = num_bytes / 32; bursts; bursts--) {
+			uint32_t sta;
+			while (!((sta = sdmmc->STA) & SDMMC_STA_RXFIFOHF)) {
+				if (sta & ErrorFlags) {
+					_last_status = sta;
+					return false;
+				}
+			}
+
+			for (uint32_t i = 0; i < 8; i++)
+				*dst32++ = sdmmc->FIFO;
+		}
+		return true;
+	}
+
+	// Sending CMD0 with BOOTEN cleared ends the boot operation,
+	// and CMDSTOP aborts the data transfer. The device is left in idle state.
+	void end_boot_operation()
+	{
+		sdmmc->ICR = CmdFlags;
+		sdmmc->ARG = 0;
+		sdmmc->CMD = Cmd::GoIdle | SDMMC_CMD_BOOTMODE | SDMMC_CMD_CMDSTOP | SDMMC_CMD_CPSMEN;
+
+		auto deadline = deadline_us(CmdTimeout_us);
+		while (!(sdmmc->STA & SDMMC_STA_CMDSENT) && !deadline_passed(deadline))
+			;
+
+		end_data(false, false);
+		sdmmc->ICR = SDMMC_ICR_ACKFAILC | SDMMC_ICR_ACKTIMEOUTC;
+	}
+
+	// Writes a byte of an eMMC's EXT_CSD (CMD6), and waits until the device is done
+	bool mmc_switch(uint8_t index, uint8_t value)
+	{
+		constexpr uint32_t WriteByte = 3;
+		if (!send_cmd(Cmd::MMCSwitch, (WriteByte << 24) | (index << 16) | (value << 8), Response::R1b))
+			return false;
+
+		// The last status (CMD13) is in RESP1
+		if (!wait_for_transfer_state())
+			return false;
+		return !(sdmmc->RESP1 & R1_SwitchError);
+	}
+
+	// If we booted from SD, the BOOTROM left the card powered, identified and
+	// selected (transfer state). Rather than power cycling it and going through
+	// the whole identification at 400kHz (init()), deselect the card and
+	// ask it for a new RCA (CMD3 is allowed in stand-by state), read the CSD and CID,
+	// select it again and set the bus width.
+	// Returns false if the card doesn't respond as expected.
+	bool resume()
+	{
+		if ((sdmmc->POWER & SDMMC_POWER_PWRCTRL) != SDMMC_POWER_PWRCTRL)
+			return false;
+
+		sdmmc->DCTRL = 0;
+		sdmmc->IDMACTRL = 0;
+		sdmmc->CMD = 0;
+		sdmmc->ICR = StaticFlags;
+
+		// CMD7 with RCA 0 deselects the card. Deselected cards don't respond.
+		if (!send_cmd(Cmd::SelectCard, 0, Response::None))
+			return false;
+
+		if (!identify_and_select())
+			return false;
+
+		return card_state() == CardState::Transfer;
+	}
+
+	// SDMMC_CK = kernel clock / (2 * clock_div)
+	void set_clock_div(uint32_t clock_div)
+	{
+		sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_CLKDIV) | (clock_div << SDMMC_CLKCR_CLKDIV_Pos);
+	}
+
+	// 1, 4 or 8 data lines
+	void set_bus_width(uint32_t bits)
+	{
+		uint32_t widbus = bits == 8 ? SDMMC_CLKCR_WIDBUS_1 : bits == 4 ? SDMMC_CLKCR_WIDBUS_0 : 0;
+		sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_WIDBUS) | widbus;
+	}
+
+	// Data on both clock edges (DDR52). CLKDIV must not be 0
+	void set_ddr(bool ddr) { sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_DDR) | (ddr ? SDMMC_CLKCR_DDR : 0); }
+
+	// Bus speed setting for clocks over 50MHz (SDR50, SDR104, HS200)
+	void set_high_bus_speed(bool high)
+	{
+		sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_BUSSPEED) | (high ? SDMMC_CLKCR_BUSSPEED : 0);
+	}
+
+	// Selects the receive clock: 0 = sdmmc_io_in_ck, 2 = sdmmc_fb_ck (through the delay block)
+	void set_rx_clock(uint32_t selclkrx)
+	{
+		sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_SELCLKRX) | (selclkrx << SDMMC_CLKCR_SELCLKRX_Pos);
+	}
+
+	uint32_t num_blocks() const { return _num_blocks; }
+
+	// The card's CID register, from RESP1 (bits 127:96) to RESP4
+	const uint32_t *cid() const { return _cid; }
+
+	// Multi-block reads are pre-defined (CMD23), rather than open-ended
+	bool uses_cmd23() const { return supports_cmd23; }
+
+	// STA at the last data transfer error
+	uint32_t last_status() const { return _last_status; }
+
+	// The last DMA read failed because a chunk callback took too long
+	bool dma_overrun() const { return _dma_overrun; }
+
+	// CMD6: check that the card supports High Speed (function 1 of group 1), then switch to it
+	bool switch_to_high_speed()
+	{
+		uint8_t status[64];
+
+		// Mode 0: query
+		if (!switch_function(0x00FFFFF1, status))
+			return false;
+		if (!(status[13] & (1 << 1)))
+			return false;
+
+		// Mode 1: switch
+		if (!switch_function(0x80FFFFF1, status))
+			return false;
+		if ((status[16] & 0x0F) != 1)
+			return false;
+
+		// The card switches within 8 clocks after the status block
+		return wait_for_transfer_state();
+	}
+
+	// Reads blocks into dst (any alignment) with the CPU.
+	// Returns false if the read failed or timed out (data_timeout is in card clock cycles)
+	bool read_blocks(uint8_t *dst, uint32_t blockaddr, uint32_t num_blocks, uint32_t data_timeout = DefaultDataTimeout)
+	{
+		if (num_blocks == 0 || num_blocks > MaxBlocksPerRead)
+			return false;
+
+		const bool multi = num_blocks > 1;
+		const bool open_ended = multi && !supports_cmd23;
+
+		if (multi && !open_ended && !send_cmd(Cmd::SetBlockCount, num_blocks, Response::R1))
+			return false;
+
+		start_data(num_blocks * BlockSize, DataBlockSize512, data_timeout);
+		if (!send_cmd(multi ? Cmd::ReadMultipleBlock : Cmd::ReadSingleBlock, card_address(blockaddr), Response::R1, true))
+			return abort_data(false);
+
+		bool ok = read_fifo(dst, num_blocks * BlockSize);
+		return end_data(ok, open_ended);
+	}
+
+	// Reads blocks with the IDMA in double-buffer mode. The two IDMA buffers are consecutive
+	// chunks of the destination: when one completes, it's re-pointed to the next chunk while
+	// the other is filling, and chunk_done(offset, length) is called for the completed chunk.
+	// chunk_done must return before the other buffer completes: if it doesn't, the read
+	// fails and dma_overrun() is true.
+	// dst must be word-aligned.
+	template<uint32_t ChunkSize, typename F>
+	bool read_blocks_dma(uint8_t *dst, uint32_t blockaddr, uint32_t num_blocks, F &&chunk_done)
+	{
+		static_assert(ChunkSize % BlockSize == 0 && (ChunkSize >> 5) <= (SDMMC_IDMABSIZE_IDMABNDT_Msk >> 5),
+					  "IDMA buffer size must be a multiple of the block size and fit in IDMABNDT");
+
+		if (num_blocks == 0 || num_blocks > MaxBlocksPerRead)
+			return false;
+
+		const uint32_t num_bytes = num_blocks * BlockSize;
+		const bool open_ended = !supports_cmd23;
+
+		if (!open_ended && !send_cmd(Cmd::SetBlockCount, num_blocks, Response::R1))
+			return false;
+
+		// No dirty cache lines may be evicted on top of the DMA'ed data
+		dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(dst), num_bytes);
+
+		_dma_overrun = false;
+		start_data(num_bytes, DataBlockSize512, DefaultDataTimeout);
+		sdmmc->IDMABASE0 = reinterpret_cast<uint32_t>(dst);
+		sdmmc->IDMABASE1 = reinterpret_cast<uint32_t>(dst + ChunkSize);
+		sdmmc->IDMABSIZE = ChunkSize;
+		sdmmc->IDMACTRL = SDMMC_IDMA_IDMAEN | SDMMC_IDMA_IDMABMODE;
+
+		if (!send_cmd(Cmd::ReadMultipleBlock, card_address(blockaddr), Response::R1, true))
+			return abort_data(false);
+
+		// Offset of the first byte not yet passed to chunk_done,
+		// and of the first byte not yet assigned to an IDMA buffer
+		uint32_t done_offset = 0;
+		uint32_t next_offset = 2 * ChunkSize;
+
+		while (true) {
+			uint32_t sta = sdmmc->STA;
+
+			if (sta & DataErrorFlags) {
+				_last_status = sta;
+				return abort_data(true);
+			}
+
+			if (sta & SDMMC_STA_IDMABTC) {
+				sdmmc->ICR = SDMMC_ICR_IDMABTCC;
+
+				// The buffer that just completed is the one that's not active now.
+				// Point it to the next chunk before the active one finishes.
+				if (next_offset < num_bytes) {
+					if (idma_overran(num_bytes, done_offset, ChunkSize))
+						return abort_data(true);
+					auto next = reinterpret_cast<uint32_t>(dst + next_offset);
+					if (sdmmc->IDMACTRL & SDMMC_IDMA_IDMABACT)
+						sdmmc->IDMABASE0 = next;
+					else
+						sdmmc->IDMABASE1 = next;
+					next_offset += ChunkSize;
+				}
+
+				// The last chunk is handled after DATAEND
+				if (done_offset < num_bytes && !(sta & SDMMC_STA_DATAEND)) {
+					auto len = std::min(ChunkSize, num_bytes - done_offset);
+					dcache_invalidate_range(reinterpret_cast<uint32_t>(dst + done_offset), len);
+					chunk_done(done_offset, len);
+					done_offset += len;
+				}
+			}
+
+			if (sta & SDMMC_STA_DATAEND)
+				break;
+		}
+
+		if (!end_data(true, open_ended))
+			return false;
+
+		// Drop any lines that were speculatively loaded during the transfer
+		if (done_offset < num_bytes) {
+			dcache_invalidate_range(reinterpret_cast<uint32_t>(dst + done_offset), num_bytes - done_offset);
+			chunk_done(done_offset, num_bytes - done_offset);
+		}
+		return true;
+	}
+
+	// Where stream_blocks_dma() puts the data, and how much of it there is
+	struct StreamDest {
+		uint8_t *dst = nullptr; // word-aligned
+		uint32_t num_bytes = 0; // 0 to abort
+	};
+
+	// Reads blocks with the IDMA in double-buffer mode, like read_blocks_dma(), when where
+	// the data goes is only known from the data (e.g. an image header). It's all one read:
+	// an open-ended CMD18 that's stopped with CMD12 once num_bytes are in.
+	// The first two chunks land in scratch (2 * ChunkSize bytes, word-aligned).
+	// When the first one is in, get_dest(scratch) returns the StreamDest.
+	// Chunks go straight to the destination, except for the first two and a partial last one,
+	// which are copied there from scratch. Then chunk_done(offset, length) is called like
+	// with read_blocks_dma(). get_dest and chunk_done must return before the next chunk is in,
+	// or the read fails and dma_overrun() is true.
+	template<uint32_t ChunkSize, typename D, typename F>
+	bool stream_blocks_dma(uint8_t *scratch, uint32_t blockaddr, D &&get_dest, F &&chunk_done)
+	{
+		static_assert(ChunkSize % BlockSize == 0 && (ChunkSize >> 5) <= (SDMMC_IDMABSIZE_IDMABNDT_Msk >> 5),
+					  "IDMA buffer size must be a multiple of the block size and fit in IDMABNDT");
+
+		dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(scratch), 2 * ChunkSize);
+
+		// The length is not known yet
+		constexpr uint32_t transfer_len = MaxBlocksPerRead * BlockSize;
+		_dma_overrun = false;
+		start_data(transfer_len, DataBlockSize512, DefaultDataTimeout);
+		sdmmc->IDMABASE0 = reinterpret_cast<uint32_t>(scratch);
+		sdmmc->IDMABASE1 = reinterpret_cast<uint32_t>(scratch + ChunkSize);
+		sdmmc->IDMABSIZE = ChunkSize;
+		sdmmc->IDMACTRL = SDMMC_IDMA_IDMAEN | SDMMC_IDMA_IDMABMODE;
+
+		if (!send_cmd(Cmd::ReadMultipleBlock, card_address(blockaddr), Response::R1, true))
+			return abort_data(false);
+
+		StreamDest dest;
+
+		// A chunk is read straight to the destination if it's all part of the data
+		auto direct = [&](uint32_t offset) { return offset >= 2 * ChunkSize && offset + ChunkSize <= dest.num_bytes; };
+
+		// Offset of the next chunk to complete, and of the first one not yet assigned to an IDMA buffer
+		uint32_t done_offset = 0;
+		uint32_t next_offset = 2 * ChunkSize;
+
+		while (done_offset == 0 || done_offset < dest.num_bytes) {
+			uint32_t sta = sdmmc->STA;
+
+			if (sta & DataErrorFlags) {
+				_last_status = sta;
+				return abort_data(true);
+			}
+
+			if (!(sta & SDMMC_STA_IDMABTC))
+				continue;
+			sdmmc->ICR = SDMMC_ICR_IDMABTCC;
+
+			// The buffer that just completed is the one that's not active now
+			const bool buffer0_done = sdmmc->IDMACTRL & SDMMC_IDMA_IDMABACT;
+			uint8_t *buffer_scratch = buffer0_done ? scratch : scratch + ChunkSize;
+
+			if (done_offset == 0) {
+				dcache_invalidate_range(reinterpret_cast<uint32_t>(scratch), ChunkSize);
+				dest = get_dest(static_cast<const uint8_t *>(scratch));
+				if (dest.num_bytes == 0 || dest.num_bytes > transfer_len)
+					return abort_data(true);
+			}
+
+			if (idma_overran(transfer_len, done_offset, ChunkSize))
+				return abort_data(true);
+
+			// Point it to the next chunk before the active one finishes.
+			// Chunks that are not all data (the ones past the end, too) go to scratch.
+			uint8_t *next = buffer_scratch;
+			if (direct(next_offset)) {
+				next = dest.dst + next_offset;
+				dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(next), ChunkSize);
+			}
+			if (buffer0_done)
+				sdmmc->IDMABASE0 = reinterpret_cast<uint32_t>(next);
+			else
+				sdmmc->IDMABASE1 = reinterpret_cast<uint32_t>(next);
+			next_offset += ChunkSize;
+
+			auto len = std::min(ChunkSize, dest.num_bytes - done_offset);
+			if (direct(done_offset)) {
+				dcache_invalidate_range(reinterpret_cast<uint32_t>(dest.dst + done_offset), len);
+			} else {
+				dcache_invalidate_range(reinterpret_cast<uint32_t>(buffer_scratch), len);
+				copy_chunk(dest.dst + done_offset, buffer_scratch, len);
+			}
+			chunk_done(done_offset, len);
+			done_offset += ChunkSize;
+		}
+
+		// The card is still sending (to scratch): CMD12 aborts the transfer
+		bool ok = send_cmd(Cmd::StopTransmission, 0, Response::R1b);
+		return end_data(ok, false);
+	}
+
+	// After a failed read, the card may still be sending data (or waiting to):
+	// stop it and get back to the transfer state
+	bool recover()
+	{
+		abort_data(true);
+		return wait_for_transfer_state();
+	}
+
+	CardState card_state()
+	{
+		if (!send_cmd(Cmd::SendStatus, rca << 16, Response::R1))
+			return CardState::Error;
+		return static_cast<CardState>((sdmmc->RESP1 >> 9) & 0xF);
+	}
+
+	bool wait_for_transfer_state()
+	{
+		auto deadline = deadline_us(BusyTimeout_us);
+		while (!deadline_passed(deadline)) {
+			if (card_state() == CardState::Transfer)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	enum Cmd : uint32_t {
+		GoIdle = 0,
+		AllSendCID = 2,
+		SendRelativeAddr = 3,
+		SwitchFunc = 6,
+		SelectCard = 7,
+		SendIfCond = 8,
+		SendCSD = 9,
+		SendCID = 10,
+		StopTransmission = 12,
+		SendStatus = 13,
+		SetBlockLen = 16,
+		ReadSingleBlock = 17,
+		ReadMultipleBlock = 18,
+		SetBlockCount = 23,
+		AppCmd = 55,
+
+		// eMMC
+		MMCSendOpCond = 1,
+		MMCSetRelativeAddr = 3,
+		MMCSwitch = 6,
+		MMCSendExtCSD = 8,
+
+		// After AppCmd
+		SetBusWidth = 6,
+		SDSendOpCond = 41,
+		SendSCR = 51,
+	};
+
+	enum class Response { None, R1, R1b, R2, R3, R6, R7 };
+
+	static constexpr uint32_t InitClockDiv = 80; // 64MHz / (2 * 80) = 400kHz
+	static constexpr uint32_t CheckPattern = 0x1AA;
+	static constexpr uint32_t VoltageWindow = 0x80100000;
+	static constexpr uint32_t OCR_HighCapacity = 0x40000000;
+	static constexpr uint32_t OCR_PowerUpDone = 0x80000000;
+	static constexpr uint32_t MMCVoltageWindow = 0x00FF8080; // 2.7-3.6V and 1.7-1.95V
+	static constexpr uint32_t OCR_SectorMode = 0x40000000;
+	static constexpr uint32_t OCR_AccessModeMask = 0x60000000;
+
+	static constexpr uint32_t GoPreIdleArg = 0xF0F0F0F0;
+	static constexpr uint32_t AltBootArg = 0xFFFFFFFA;
+	static constexpr uint32_t BootClockDiv = 2;				 // 64MHz / (2 * 2) = 16MHz, within legacy timing
+	static constexpr uint32_t BootAckTimeout = 16000000 / 20; // The ack must come within 50ms
+	static constexpr uint32_t BootDataTimeout = 16000000;	 // and the data within 1s
+	static constexpr uint32_t PowerUpTimeout_us = 1000000; // ACMD41/CMD1 must report ready within 1s
+	static constexpr uint32_t R1_ErrorBits = 0xFDFFE008;
+	static constexpr uint32_t R1_SwitchError = 1 << 7;
+
+	static constexpr uint32_t DataBlockSize512 = 9;
+
+	static constexpr uint32_t CmdFlags = SDMMC_STA_CCRCFAIL | SDMMC_STA_CTIMEOUT | SDMMC_STA_CMDREND | SDMMC_STA_CMDSENT;
+	static constexpr uint32_t DataErrorFlags = SDMMC_STA_DCRCFAIL | SDMMC_STA_DTIMEOUT | SDMMC_STA_RXOVERR | SDMMC_STA_IDMATE;
+	static constexpr uint32_t StaticFlags = CmdFlags | DataErrorFlags | SDMMC_STA_DATAEND | SDMMC_STA_DBCKEND |
+											SDMMC_STA_DABORT | SDMMC_STA_BUSYD0END | SDMMC_STA_IDMABTC;
+
+	// Backs up the hardware's response timeout. At 400kHz, a command and its response take about 300us
+	static constexpr uint32_t CmdTimeout_us = 10000;
+	// R1b busy (e.g. an eMMC SWITCH), and the card getting back to transfer state
+	static constexpr uint32_t BusyTimeout_us = 1000000;
+
+	void power_up()
+	{
+		sdmmc->POWER = 0;
+		udelay(1000);
+
+		sdmmc->CLKCR = InitClockDiv | SDMMC_CLKCR_HWFC_EN;
+		sdmmc->POWER = SDMMC_POWER_PWRCTRL;
+
+		// The card needs 74 clocks after power up
+		udelay(1000);
+	}
+
+	// CMD3 (new RCA), CMD9 (CSD), CMD7 (select), ACMD6 (4-bit bus), ACMD51 (SCR).
+	// The card must be in stand-by state (after identification, or deselected)
+	bool identify_and_select()
+	{
+		if (!send_cmd(Cmd::SendRelativeAddr, 0, Response::R6))
+			return false;
+		rca = sdmmc->RESP1 >> 16;
+
+		if (!send_cmd(Cmd::SendCSD, rca << 16, Response::R2))
+			return false;
+		const uint32_t csd[4] = {sdmmc->RESP1, sdmmc->RESP2, sdmmc->RESP3, sdmmc->RESP4};
+		_num_blocks = capacity_from_csd(csd);
+
+		// Also when resuming, where CMD2 isn't sent
+		if (!send_cmd(Cmd::SendCID, rca << 16, Response::R2))
+			return false;
+		save_cid();
+
+		if (!send_cmd(Cmd::SelectCard, rca << 16, Response::R1b))
+			return false;
+
+		if (!send_app_cmd(Cmd::SetBusWidth, 2, Response::R1, rca))
+			return false;
+		sdmmc->CLKCR = (sdmmc->CLKCR & ~SDMMC_CLKCR_WIDBUS) | SDMMC_CLKCR_WIDBUS_0;
+
+		// SDSC cards can have other block lengths
+		if (!high_capacity && !send_cmd(Cmd::SetBlockLen, BlockSize, Response::R1))
+			return false;
+
+		// SCR bit 33: CMD23 supported. SCR bytes are sent MSB first
+		uint8_t scr[8];
+		supports_cmd23 = read_register_data(Cmd::SendSCR, 0, true, scr) && (scr[3] & 0x02);
+
+		return true;
+	}
+
+	void save_cid()
+	{
+		_cid[0] = sdmmc->RESP1;
+		_cid[1] = sdmmc->RESP2;
+		_cid[2] = sdmmc->RESP3;
+		_cid[3] = sdmmc->RESP4;
+	}
+
+	// CSD version 2.0 (SDHC/SDXC) has C_SIZE in units of 512kB.
+	// Version 1.0 (SDSC) has C_SIZE, C_SIZE_MULT and READ_BL_LEN.
+	static uint32_t capacity_from_csd(const uint32_t (&csd)[4])
+	{
+		if ((csd[0] >> 30) == 1) {
+			uint32_t c_size = ((csd[1] & 0x3F) << 16) | (csd[2] >> 16);
+			return (c_size + 1) * 1024;
+		}
+
+		uint32_t c_size = ((csd[1] & 0x3FF) << 2) | (csd[2] >> 30);
+		uint32_t c_size_mult = (csd[2] >> 15) & 0x7;
+		uint32_t read_bl_len = (csd[1] >> 16) & 0xF;
+		return ((c_size + 1) << (c_size_mult + 2)) << (read_bl_len - 9);
+	}
+
+	uint32_t card_address(uint32_t blockaddr) const { return high_capacity ? blockaddr : blockaddr * BlockSize; }
+
+	// Sends CMD6 and reads the 512-bit switch status.
+	// Bytes are in the order they're sent (byte 0 is bits 511:504)
+	bool switch_function(uint32_t arg, uint8_t (&status)[64])
+	{
+		return read_register_data(Cmd::SwitchFunc, arg, false, status);
+	}
+
+	// Reads the data block of a command that returns a register or status (CMD6, ACMD51, eMMC CMD8)
+	template<uint32_t N>
+	bool read_register_data(uint32_t cmd, uint32_t arg, bool app_cmd, uint8_t (&data)[N])
+	{
+		static_assert(N == 8 || N == 64 || N == 512);
+		constexpr uint32_t block_size_pow = N == 8 ? 3 : N == 64 ? 6 : 9;
+
+		if (app_cmd && !send_cmd(Cmd::AppCmd, rca << 16, Response::R1))
+			return false;
+
+		start_data(N, block_size_pow, DefaultDataTimeout);
+		if (!send_cmd(cmd, arg, Response::R1, true))
+			return abort_data(false);
+
+		bool ok = read_fifo(data, N);
+		return end_data(ok, false);
+	}
+
+	bool send_app_cmd(uint32_t cmd, uint32_t arg, Response response, uint32_t card_rca)
+	{
+		if (!send_cmd(Cmd::AppCmd, card_rca << 16, Response::R1))
+			return false;
+		return send_cmd(cmd, arg, response);
+	}
+
+	bool send_cmd(uint32_t cmd, uint32_t arg, Response response, bool starts_data = false)
+	{
+		uint32_t waitresp = response == Response::None ? 0 :
+							response == Response::R2   ? 3 :
+							response == Response::R3   ? 2 : // R3 has no CRC
+														 1;
+
+		sdmmc->ICR = CmdFlags;
+		sdmmc->ARG = arg;
+		sdmmc->CMD = cmd | (waitresp << SDMMC_CMD_WAITRESP_Pos) | (starts_data ? SDMMC_CMD_CMDTRANS : 0) |
+					 (cmd == Cmd::StopTransmission ? SDMMC_CMD_CMDSTOP : 0) | SDMMC_CMD_CPSMEN;
+
+		uint32_t done_flags = response == Response::None ? SDMMC_STA_CMDSENT : CmdFlags;
+		uint32_t sta;
+		auto deadline = deadline_us(CmdTimeout_us);
+		while (!((sta = sdmmc->STA) & done_flags)) {
+			if (deadline_passed(deadline))
+				return false;
+		}
+		sdmmc->ICR = CmdFlags;
+
+		if (response == Response::None)
+			return true;
+
+		if (sta & SDMMC_STA_CTIMEOUT)
+			return false;
+
+		if ((sta & SDMMC_STA_CCRCFAIL) && response != Response::R3)
+			return false;
+
+		if (response == Response::R2 || response == Response::R3)
+			return true;
+
+		if (sdmmc->RESPCMD != cmd)
+			return false;
+
+		if ((response == Response::R1 || response == Response::R1b) && (sdmmc->RESP1 & R1_ErrorBits))
+			return false;
+
+		if (response == Response::R1b) {
+			deadline = deadline_us(BusyTimeout_us);
+			while (sdmmc->STA & SDMMC_STA_BUSYD0) {
+				if (deadline_passed(deadline))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	void start_data(uint32_t num_bytes, uint32_t block_size_pow, uint32_t data_timeout)
+	{
+		sdmmc->DCTRL = 0;
+		sdmmc->ICR = StaticFlags;
+		sdmmc->DTIMER = data_timeout;
+		sdmmc->DLEN = num_bytes;
+		sdmmc->DCTRL = (block_size_pow << SDMMC_DCTRL_DBLOCKSIZE_Pos) | SDMMC_DCTRL_DTDIR;
+	}
+
+	// Reads num_bytes (a multiple of 4) from the FIFO, 8 words at a time while it's half full
+	bool read_fifo(uint8_t *dst, uint32_t num_bytes)
+	{
+		using unaligned_u32 = uint32_t __attribute__((aligned(1), may_alias));
+		auto *dst32 = reinterpret_cast<unaligned_u32 *>(dst);
+		uint32_t words_left = num_bytes / 4;
+
+		uint32_t sta;
+		while (!((sta = sdmmc->STA) & (DataErrorFlags | SDMMC_STA_DATAEND))) {
+			if ((sta & SDMMC_STA_RXFIFOHF) && words_left >= 8) {
+				for (uint32_t i = 0; i < 8; i++)
+					*dst32++ = sdmmc->FIFO;
+				words_left -= 8;
+			}
+		}
+
+		if (sta & DataErrorFlags) {
+			_last_status = sta;
+			return false;
+		}
+
+		while (words_left && !(sdmmc->STA & SDMMC_STA_RXFIFOE)) {
+			*dst32++ = sdmmc->FIFO;
+			words_left--;
+		}
+
+		return words_left == 0;
+	}
+
+	// Copies num_bytes from and to word-aligned buffers: whole words, then the last
+	// bytes one by one, so nothing past dst + num_bytes is written.
+	// Kept as loops: there's no memcpy to call
+	__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void
+	copy_chunk(uint8_t *dst, const uint8_t *src, uint32_t num_bytes)
+	{
+		auto *dst32 = reinterpret_cast<uint32_t *>(dst);
+		auto *src32 = reinterpret_cast<const uint32_t *>(src);
+		for (uint32_t words = num_bytes / 4; words; words--)
+			*dst32++ = *src32++;
+
+		for (uint32_t i = num_bytes & ~3; i < num_bytes; i++)
+			dst[i] = src[i];
+	}
+
+	// With IDMA double-buffering, when a buffer completes (the chunk at done_offset), the
+	// other one is filling with the next chunk. If the data path has already received
+	// (nearly) all of that next chunk, the IDMA may have moved on to the completed buffer
+	// before it's re-pointed, writing over data that was handed on. This happens if
+	// chunk_done took too long, or if two buffer completions were seen as one.
+	// One block of margin covers the time between this check and re-pointing the buffer.
+	bool idma_overran(uint32_t transfer_len, uint32_t done_offset, uint32_t chunk_size)
+	{
+		uint32_t received = transfer_len - sdmmc->DCOUNT;
+		_dma_overrun = received + BlockSize > done_offset + 2 * chunk_size;
+		return _dma_overrun;
+	}
+
+	// Ends a data transfer, sending CMD12 if the card is still sending blocks
+	bool end_data(bool ok, bool send_stop)
+	{
+		sdmmc->CMD = 0;
+		sdmmc->DLEN = 0;
+		sdmmc->DCTRL = 0;
+		sdmmc->IDMACTRL = 0;
+
+		if (send_stop && !send_cmd(Cmd::StopTransmission, 0, Response::R1b))
+			ok = false;
+
+		sdmmc->ICR = StaticFlags;
+		return ok;
+	}
+
+	bool abort_data(bool send_stop)
+	{
+		end_data(false, send_stop);
+		return false;
+	}
+};
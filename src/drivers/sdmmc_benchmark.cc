@@ -0,0 +1,37 @@
+#include "sdmmc_benchmark.hh"
+#include "drivers/benchmark_report.hh"
+#include "drivers/cycle_counter.hh"
+#include "mmu.h"
+#include "print_messages.hh"
+
+namespace SDMMCBenchmark
+{
+
+void run(SDMMC_Controller &card, uint8_t *dst, uint32_t size, uint32_t cpu_hz)
+{
+	constexpr uint32_t DMAChunkSize = 64 * 1024;
+	const uint32_t num_blocks = size / SDMMC_Controller::BlockSize;
+
+	CycleCounter::init();
+
+	dcache_clean_invalidate_range(reinterpret_cast<uint32_t>(dst), size);
+	uint32_t start = CycleCounter::read();
+	bool cpu_ok = card.read_blocks(dst, 0, num_blocks);
+	uint32_t cpu_cycles = CycleCounter::read() - start;
+
+	start = CycleCounter::read();
+	bool dma_ok = card.read_blocks_dma<DMAChunkSize>(dst, 0, num_blocks, [](uint32_t, uint32_t) {});
+	uint32_t dma_cycles = CycleCounter::read() - start;
+
+	print("SDMMC read benchmark (", card.uses_cmd23() ? "CMD23 + CMD18" : "CMD18 + CMD12", "):\n");
+	if (cpu_ok)
+		report_throughput("  CPU:  ", num_blocks * SDMMC_Controller::BlockSize, cpu_cycles, cpu_hz);
+	else
+		print("  CPU:  failed\n");
+	if (dma_ok)
+		report_throughput("  IDMA: ", num_blocks * SDMMC_Controller::BlockSize, dma_cycles, cpu_hz);
+	else
+		print("  IDMA: failed\n");
+}
+
+} // namespace SDMMCBenchmark
@@ -0,0 +1,10 @@
+#pragma once
+#include "drivers/sdmmc.hh"
+#include <cstdint>
+
+namespace SDMMCBenchmark
+{
+// Compares read throughput of the CPU (FIFO polling) and the IDMA.
+// The card must already be initialized, reads start at block 0.
+void run(SDMMC_Controller &card, uint8_t *dst, uint32_t size, uint32_t cpu_hz);
+} // namespace SDMMCBenchmark
@@ -0,0 +1,137 @@
+#pragma once
+#include "drivers/rcc.hh"
+#include "mmu.h"
+#include "stm32mp1xx.h"
+#include <algorithm>
+#include <cstdint>
+
+// Buffered console output: putchar() appends to a ring buffer in SYSRAM, and DMA1
+// feeds the UART from it while the CPU carries on.
+// There are no interrupts, so a new transfer is only started from putchar() or flush():
+// text written while a transfer is running goes out with the next one.
+// Call flush() before anything that needs all the text out (jumping to an image, hanging).
+// The UART must already be initialized (see Uart). If the UART has no DMA request,
+// putchar() writes to the UART directly, waiting for room in its FIFO.
+template<uint32_t BASE_ADDR>
+class UartDMAConsole {
+	static USART_TypeDef *uart() { return reinterpret_cast<USART_TypeDef *>(BASE_ADDR); }
+	static DMA_Stream_TypeDef *stream() { return DMA1_Stream7; }
+	static DMAMUX_Channel_TypeDef *dmamux() { return DMAMUX1_Channel7; } // DMAMUX1 channels 0-7 are DMA1 streams 0-7
+	static constexpr uint32_t StreamFlags = DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 | DMA_HIFCR_CDMEIF7 |
+											DMA_HIFCR_CFEIF7;
+
+	static constexpr uint32_t BufferSize = 4096; // must be a power of 2
+
+	static inline char buffer[BufferSize];
+	static inline uint32_t head = 0;	  // Next byte to write (free-running)
+	static inline uint32_t tail = 0;	  // Next byte to send (free-running)
+	static inline uint32_t in_flight = 0; // Bytes in the transfer that's running
+	static inline bool dma_ready = false;
+
+public:
+	static void putchar(const char c)
+	{
+		if constexpr (tx_dma_request() == 0) {
+			while ((uart()->ISR & USART_ISR_TXFT) == 0)
+				;
+			uart()->TDR = c;
+		} else {
+			while (head - tail == BufferSize)
+				kick();
+
+			buffer[head % BufferSize] = c;
+			head++;
+			kick();
+		}
+	}
+
+	// Waits until everything is sent, and leaves the UART without DMA
+	static void flush()
+	{
+		if constexpr (tx_dma_request() != 0) {
+			if (!dma_ready)
+				return;
+
+			while (head != tail || in_flight)
+				kick();
+
+			while ((uart()->ISR & USART_ISR_TC) == 0)
+				;
+
+			uart()->CR3 = uart()->CR3 & ~USART_CR3_DMAT;
+			dma_ready = false;
+		}
+	}
+
+private:
+	// Starts a transfer of the bytes waiting in the buffer, if the last one is done.
+	// Sends up to the end of the buffer: the rest goes with the next transfer.
+	static void kick()
+	{
+		if (!dma_ready)
+			init_dma();
+
+		if (stream()->CR & DMA_SxCR_EN)
+			return;
+
+		tail += in_flight;
+		in_flight = 0;
+
+		if (head == tail)
+			return;
+
+		uint32_t start = tail % BufferSize;
+		uint32_t len = std::min(head - tail, BufferSize - start);
+		auto addr = reinterpret_cast<uint32_t>(&buffer[start]);
+		dcache_clean_range(addr, len);
+
+		DMA1->HIFCR = StreamFlags;
+		stream()->M0AR = addr;
+		stream()->NDTR = len;
+		stream()->CR = stream()->CR | DMA_SxCR_EN;
+		in_flight = len;
+	}
+
+	// Memory to peripheral, one byte at a time, direct mode
+	static void init_dma()
+	{
+		mdrivlib::RCC_Enable::DMA1_::set();
+		mdrivlib::RCC_Enable::DMAMUX_::set();
+
+		stream()->CR = 0;
+		while (stream()->CR & DMA_SxCR_EN)
+			;
+		DMA1->HIFCR = StreamFlags;
+
+		dmamux()->CCR = tx_dma_request() << DMAMUX_CxCR_DMAREQ_ID_Pos;
+		stream()->PAR = reinterpret_cast<uint32_t>(&uart()->TDR);
+		stream()->FCR = 0;
+		stream()->CR = DMA_SxCR_DIR_0 | DMA_SxCR_MINC;
+
+		uart()->CR3 = uart()->CR3 | USART_CR3_DMAT;
+		dma_ready = true;
+	}
+
+	// DMAMUX1 request inputs for the UARTs' TX. 0 if the UART has none (USART1)
+	static constexpr uint32_t tx_dma_request()
+	{
+		switch (BASE_ADDR) {
+			case USART2_BASE:
+				return 44;
+			case USART3_BASE:
+				return 46;
+			case UART4_BASE:
+				return 64;
+			case UART5_BASE:
+				return 66;
+			case USART6_BASE:
+				return 72;
+			case UART7_BASE:
+				return 80;
+			case UART8_BASE:
+				return 82;
+			default:
+				return 0;
+		}
+	}
+};
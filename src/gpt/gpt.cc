@@ -4,7 +4,6 @@ extern "C" {
 #include "compiler.h"
 #include "part_efi.h"
 
-// TODO: convert pr_err and log messages to print() format
 #include "print_messages.hh"
 // #define log(...)
 // #define pr_err(...)
@@ -0,0 +1,92 @@
+#pragma once
+#include "crc/crc32.hh"
+#include "drivers/bkpsram.hh"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Remembers where the image partitions were found, in the backup SRAM, so that after
+// a reset (warm reboot, watchdog) the GPT doesn't need to be parsed again.
+// The cache is for one card (by its CID) and one GPT header (by its location and CRC):
+// re-reading that header and comparing its CRC field is enough to know the cache is good.
+struct GPTCache {
+	static constexpr uint32_t Magic = 0x43545047; // "GPTC"
+	static constexpr uint32_t NumSlots = 2;		  // One per LoadTarget
+	static constexpr uint32_t Empty = 0xFFFFFFFF;
+
+	struct Hit {
+		uint32_t gpt_lba;
+		uint32_t gpt_crc;
+		uint32_t blockaddr;
+	};
+
+	// The entry in slot, if it's for this card and was found with the same query (see GPTPartitionQuery::id())
+	static std::optional<Hit> find(const uint32_t *cid, uint32_t slot, uint32_t query_id)
+	{
+		BackupSRAM::init();
+		auto &c = cache();
+
+		auto &entry = c.entries[slot];
+		if (!valid(c) || !same_card(c, cid) || entry.blockaddr == Empty || entry.query_id != query_id)
+			return std::nullopt;
+
+		return Hit{c.gpt_lba, c.gpt_crc, entry.blockaddr};
+	}
+
+	// Stores an entry. If the cache was for another card or GPT header, the other entries are dropped.
+	static void store(const uint32_t *cid, uint32_t gpt_lba, uint32_t gpt_crc, uint32_t slot, uint32_t query_id,
+					  uint32_t blockaddr)
+	{
+		BackupSRAM::init();
+		auto &c = cache();
+
+		if (!valid(c) || !same_card(c, cid) || c.gpt_lba != gpt_lba || c.gpt_crc != gpt_crc) {
+			c.magic = Magic;
+			for (uint32_t i = 0; i < 4; i++)
+				c.cid[i] = cid[i];
+			c.gpt_lba = gpt_lba;
+			c.gpt_crc = gpt_crc;
+			for (auto &entry : c.entries)
+				entry.blockaddr = Empty;
+		}
+
+		c.entries[slot].query_id = query_id;
+		c.entries[slot].blockaddr = blockaddr;
+		c.crc = checksum(c);
+	}
+
+private:
+	struct Entry {
+		uint32_t query_id;
+		uint32_t blockaddr; // Empty if the slot is not used
+	};
+
+	struct Data {
+		uint32_t magic;
+		uint32_t cid[4];
+		uint32_t gpt_lba; // The GPT header the entries were found with (primary or backup)
+		uint32_t gpt_crc; // and its header_crc32 field
+		Entry entries[NumSlots];
+		uint32_t crc; // Of everything above
+	};
+
+	static Data &cache() { return BackupSRAM::at<Data>(BackupSRAM::GPTCacheOffset); }
+
+	static uint32_t checksum(const Data &c)
+	{
+		CRC32::Checksum crc;
+		crc.add(reinterpret_cast<const uint8_t *>(&c), offsetof(Data, crc));
+		return crc.value();
+	}
+
+	static bool valid(const Data &c) { return c.magic == Magic && c.crc == checksum(c); }
+
+	static bool same_card(const Data &c, const uint32_t *cid)
+	{
+		for (uint32_t i = 0; i < 4; i++) {
+			if (c.cid[i] != cid[i])
+				return false;
+		}
+		return true;
+	}
+};
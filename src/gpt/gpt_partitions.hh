@@ -0,0 +1,137 @@
+#pragma once
+#include "crc/crc32.hh"
+#include "gpt.hh"
+#include "print_messages.hh"
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+// How to recognize a partition. Fields that are not given (nullptr or 0) are not used.
+// A partition with the name wins over one with the type GUID, which wins over the number.
+struct GPTPartitionQuery {
+	const char *name = nullptr;		  // ASCII, compared to the UTF-16 partition name
+	const efi_guid_t *type = nullptr; // Partition type GUID
+	uint32_t number = 0;			  // 1 is the first entry
+
+	// Changes if the query changes (for caching the results)
+	uint32_t id() const
+	{
+		CRC32::Checksum crc;
+		if (name) {
+			uint32_t len = 0;
+			while (name[len])
+				len++;
+			crc.add(reinterpret_cast<const uint8_t *>(name), len + 1);
+		}
+		if (type)
+			crc.add(type->b, sizeof type->b);
+		crc.add(reinterpret_cast<const uint8_t *>(&number), sizeof number);
+		return crc.value();
+	}
+};
+
+// Finds partitions in a GPT's partition entry array. The array is read into a buffer
+// with one multi-block read (if the buffer can hold it, which it can for the usual
+// 128 entries with 16kB), and checked against the header's partition_entry_array_crc32.
+// All the queries are resolved in the same pass over the entries.
+struct GPTPartitions {
+	static constexpr uint64_t NotFound = ~0ULL;
+	static constexpr uint32_t MaxQueries = 4;
+	static constexpr uint32_t BlockSize = 512;
+
+	// read_blocks(dst, lba, num_blocks) returns false on error.
+	// buf must be a multiple of the block size, and word-aligned.
+	// start_lbas gets the first block of the partition for each query, or NotFound.
+	// Returns false if the entry array could not be read or its CRC is wrong.
+	template<typename ReadBlocks>
+	static bool find(const gpt_header &header,
+					 std::span<uint8_t> buf,
+					 ReadBlocks &&read_blocks,
+					 std::span<const GPTPartitionQuery> queries,
+					 std::span<uint64_t> start_lbas)
+	{
+		const uint32_t entry_size = header.sizeof_partition_entry;
+		const uint32_t num_entries = header.num_partition_entries;
+		const uint32_t buf_size = buf.size() - buf.size() % BlockSize;
+
+		// Entry sizes are 128 * 2^n: they don't straddle blocks
+		if (entry_size < sizeof(gpt_entry) || BlockSize % entry_size != 0 || num_entries > 0xFFFFFFFF / entry_size) {
+			pr_err("GPT: bad partition entry size or number\n");
+			return false;
+		}
+		if (queries.size() > MaxQueries || start_lbas.size() < queries.size() || buf_size == 0)
+			return false;
+
+		uint8_t rank[MaxQueries]{};
+		std::fill(start_lbas.begin(), start_lbas.end(), NotFound);
+
+		CRC32::Checksum crc;
+		uint32_t lba = header.partition_entry_lba;
+		uint32_t bytes_left = num_entries * entry_size;
+		uint32_t number = 1;
+
+		while (bytes_left) {
+			uint32_t len = std::min(bytes_left, buf_size);
+			uint32_t num_blocks = (len + BlockSize - 1) / BlockSize;
+			if (!read_blocks(buf.data(), lba, num_blocks)) {
+				pr_err("GPT: failed to read the partition entries\n");
+				return false;
+			}
+			crc.add(buf.data(), len);
+
+			for (uint32_t offset = 0; offset < len; offset += entry_size, number++)
+				match(*reinterpret_cast<const gpt_entry *>(&buf[offset]), number, queries, start_lbas, rank);
+
+			lba += num_blocks;
+			bytes_left -= len;
+		}
+
+		if (crc.value() != header.partition_entry_array_crc32) {
+			pr_err("GPT: partition entry array CRC is wrong: ", Hex{crc.value()}, " != ", Hex{header.partition_entry_array_crc32}, "\n");
+			return false;
+		}
+		return true;
+	}
+
+private:
+	enum Rank : uint8_t { NoMatch, ByNumber, ByType, ByName };
+
+	static void match(const gpt_entry &entry,
+					  uint32_t number,
+					  std::span<const GPTPartitionQuery> queries,
+					  std::span<uint64_t> start_lbas,
+					  uint8_t *rank)
+	{
+		// Unused entries have an all-zero type
+		const uint8_t *type = entry.partition_type_guid.b;
+		if (std::all_of(type, type + sizeof(efi_guid_t), [](uint8_t b) { return b == 0; }))
+			return;
+
+		for (uint32_t i = 0; i < queries.size(); i++) {
+			auto &q = queries[i];
+			Rank r = q.name && same_name(entry, q.name)					 ? ByName :
+					 q.type && same_guid(type, q.type->b)					 ? ByType :
+					 q.number == number										 ? ByNumber :
+																			   NoMatch;
+			if (r > rank[i]) {
+				rank[i] = r;
+				start_lbas[i] = entry.starting_lba;
+			}
+		}
+	}
+
+	static bool same_guid(const uint8_t *a, const uint8_t *b) { return std::equal(a, a + sizeof(efi_guid_t), b); }
+
+	// The entry is packed, so its fields are read by value
+	static bool same_name(const gpt_entry &entry, const char *name)
+	{
+		for (uint32_t i = 0; i < PARTNAME_SZ; i++) {
+			uint16_t c = entry.partition_name[i];
+			if (c != static_cast<uint8_t>(name[i]))
+				return false;
+			if (c == 0)
+				return true;
+		}
+		return name[PARTNAME_SZ] == 0;
+	}
+};
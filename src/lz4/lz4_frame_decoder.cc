@@ -0,0 +1,267 @@
+#include "lz4_frame_decoder.hh"
+#include "print_messages.hh"
+
+// LZ4 frame and block formats: https://github.com/lz4/lz4/tree/dev/doc
+
+namespace
+{
+constexpr uint32_t FrameMagic = 0x184D2204;
+constexpr uint32_t MinMatch = 4;
+
+uint32_t read_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24); }
+} // namespace
+
+void LZ4FrameDecoder::init(const uint8_t *in, uint8_t *out, uint8_t *out_limit)
+{
+	_state = State::FrameHeader;
+	_status = Status::NeedInput;
+	_in = in;
+	_in_end = in;
+	_block_end = nullptr;
+	_out_start = out;
+	_out = out;
+	_out_limit = out_limit;
+	_out_stop = out_limit;
+	_match_left = 0;
+	_match_offset = 0;
+	_has_block_checksum = false;
+	_has_content_checksum = false;
+}
+
+LZ4FrameDecoder::Status LZ4FrameDecoder::feed(const uint8_t *in_end, uint32_t max_output)
+{
+	if (_status != Status::NeedInput)
+		return _status;
+
+	if (in_end > _in_end)
+		_in_end = in_end;
+
+	_out_stop = max_output < uint32_t(_out_limit - _out) ? _out + max_output : _out_limit;
+
+	// Each step returns false if it needs more input (or on error)
+	bool progress = true;
+	while (progress && _status == Status::NeedInput) {
+		switch (_state) {
+			case State::FrameHeader:
+				progress = parse_frame_header();
+				break;
+
+			case State::BlockHeader:
+				progress = parse_block_header();
+				break;
+
+			case State::CompressedBlock:
+				progress = decode_sequences();
+				break;
+
+			case State::RawBlock:
+				progress = copy_raw();
+				break;
+
+			case State::BlockChecksum:
+				progress = skip(_has_block_checksum ? 4 : 0, State::BlockHeader);
+				break;
+
+			case State::ContentChecksum:
+				progress = skip(_has_content_checksum ? 4 : 0, State::ContentChecksum);
+				if (progress)
+					_status = Status::Done;
+				break;
+		}
+	}
+
+	return _status;
+}
+
+bool LZ4FrameDecoder::parse_frame_header()
+{
+	// Magic (4), FLG, BD, [content size (8)], [dict ID (4)], HC
+	if (available() < 7)
+		return false;
+
+	if (read_le32(_in) != FrameMagic) {
+		return error("LZ4: bad frame magic\n");
+	}
+
+	uint8_t flg = _in[4];
+	if ((flg >> 6) != 0x01) {
+		return error("LZ4: unsupported frame version\n");
+	}
+	if (flg & 0x01) {
+		return error("LZ4: dictionaries not supported\n");
+	}
+
+	_has_block_checksum = flg & (1 << 4);
+	_has_content_checksum = flg & (1 << 2);
+
+	uint32_t header_size = 7 + ((flg & (1 << 3)) ? 8 : 0);
+	if (available() < header_size)
+		return false;
+
+	// Header and content checksums are xxHash32, which we don't check:
+	// the uImage data CRC covers the whole frame.
+	_in += header_size;
+	_state = State::BlockHeader;
+	return true;
+}
+
+bool LZ4FrameDecoder::parse_block_header()
+{
+	if (available() < 4)
+		return false;
+
+	uint32_t block_size = read_le32(_in);
+	_in += 4;
+
+	if (block_size == 0) {
+		_state = State::ContentChecksum;
+		return true;
+	}
+
+	bool uncompressed = block_size & 0x80000000;
+	_block_end = _in + (block_size & 0x7FFFFFFF);
+	_state = uncompressed ? State::RawBlock : State::CompressedBlock;
+	return true;
+}
+
+bool LZ4FrameDecoder::copy_raw()
+{
+	const uint8_t *end = _block_end < _in_end ? _block_end : _in_end;
+	if (_out + (end - _in) > _out_limit) {
+		return error("LZ4: output too large\n");
+	}
+
+	while (_in < end)
+		*_out++ = *_in++;
+
+	if (_in < _block_end)
+		return false;
+
+	_state = State::BlockChecksum;
+	return true;
+}
+
+// Decodes all the complete sequences that are available.
+// A sequence is: token, [literal length bytes], literals, offset (2), [match length bytes].
+// The last sequence of a block has only literals.
+bool LZ4FrameDecoder::decode_sequences()
+{
+	const uint8_t *in_end = _block_end < _in_end ? _block_end : _in_end;
+
+	while (true) {
+		if (!copy_match())
+			return false;
+
+		// Enough output for this feed(): stop between sequences
+		if (_out >= _out_stop && _in < _block_end)
+			return false;
+
+		// Parse the whole sequence before touching the output,
+		// so we can resume from the start of it if it's incomplete
+		const uint8_t *p = _in;
+		if (p >= in_end)
+			break;
+
+		uint8_t token = *p++;
+
+		uint32_t lit_len = token >> 4;
+		if (lit_len == 15) {
+			uint8_t b;
+			do {
+				if (p >= in_end)
+					return false;
+				b = *p++;
+				lit_len += b;
+			} while (b == 255);
+		}
+
+		const uint8_t *literals = p;
+		if (lit_len > uint32_t(in_end - p)) {
+			if (in_end == _block_end)
+				return error("LZ4: corrupt block\n");
+			return false;
+		}
+		p += lit_len;
+
+		const bool last_sequence = (p == _block_end);
+
+		uint32_t offset = 0;
+		uint32_t match_len = 0;
+		if (!last_sequence) {
+			if (in_end - p < 2)
+				return false;
+			offset = p[0] | (p[1] << 8);
+			p += 2;
+
+			match_len = token & 0x0F;
+			if (match_len == 15) {
+				uint8_t b;
+				do {
+					if (p >= in_end)
+						return false;
+					b = *p++;
+					match_len += b;
+				} while (b == 255);
+			}
+			match_len += MinMatch;
+		}
+
+		if (uint32_t(_out_limit - _out) < lit_len + match_len)
+			return error("LZ4: output too large\n");
+
+		if (!last_sequence && (offset == 0 || offset > uint32_t(_out + lit_len - _out_start)))
+			return error("LZ4: bad match offset\n");
+
+		// The whole sequence is here: commit it
+		_in = p;
+
+		while (lit_len--)
+			*_out++ = *literals++;
+
+		if (last_sequence)
+			break;
+
+		_match_left = match_len;
+		_match_offset = offset;
+	}
+
+	if (_in < _block_end)
+		return false;
+
+	_state = State::BlockChecksum;
+	return true;
+}
+
+// Copies the rest of the current match, up to _out_stop.
+// Returns false if it stopped there before the end of the match.
+bool LZ4FrameDecoder::copy_match()
+{
+	uint32_t len = _match_left;
+	if (len > uint32_t(_out_stop - _out))
+		len = _out_stop > _out ? _out_stop - _out : 0;
+	_match_left -= len;
+
+	// Matches may overlap the output (offset < length), so copy forwards
+	const uint8_t *match = _out - _match_offset;
+	while (len--)
+		*_out++ = *match++;
+
+	return _match_left == 0;
+}
+
+bool LZ4FrameDecoder::skip(uint32_t num_bytes, State next)
+{
+	if (available() < num_bytes)
+		return false;
+
+	_in += num_bytes;
+	_state = next;
+	return true;
+}
+
+bool LZ4FrameDecoder::error(const char *msg)
+{
+	pr_err(msg);
+	_status = Status::Error;
+	return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+
+// Resumable LZ4 frame decoder.
+//
+// The compressed frame must arrive in order into one contiguous buffer (for
+// example, by DMA). Each time more of it is available, call feed() with the
+// end of the valid input, and the decoder will decode as far as it can. It
+// stops at the last complete sequence and picks up from there on the next
+// call, so the only state kept is a few pointers.
+//
+// Output is written to one contiguous buffer, which is also the history for
+// matches (so linked blocks work).
+//
+// A few bytes of input can decode to a lot of output (up to 255:1), so feed()
+// can be limited to about max_output bytes of output: it then stops part way
+// (even inside a match), and carries on with the next call.
+class LZ4FrameDecoder {
+public:
+	enum class Status { NeedInput, Done, Error };
+	static constexpr uint32_t NoOutputLimit = 0xFFFFFFFF;
+
+	void init(const uint8_t *in, uint8_t *out, uint8_t *out_limit);
+	Status feed(const uint8_t *in_end, uint32_t max_output = NoOutputLimit);
+
+	Status status() const { return _status; }
+	uint32_t output_size() const { return _out - _out_start; }
+
+private:
+	enum class State { FrameHeader, BlockHeader, CompressedBlock, RawBlock, BlockChecksum, ContentChecksum };
+
+	State _state = State::FrameHeader;
+	Status _status = Status::NeedInput;
+
+	const uint8_t *_in = nullptr;
+	const uint8_t *_in_end = nullptr;
+	const uint8_t *_block_end = nullptr;
+
+	uint8_t *_out_start = nullptr;
+	uint8_t *_out = nullptr;
+	uint8_t *_out_limit = nullptr;
+	uint8_t *_out_stop = nullptr; // Where this feed() stops (at the end of a sequence)
+
+	// The rest of a match that was stopped at _out_stop
+	uint32_t _match_left = 0;
+	uint32_t _match_offset = 0;
+
+	bool _has_block_checksum = false;
+	bool _has_content_checksum = false;
+
+	bool parse_frame_header();
+	bool parse_block_header();
+	bool decode_sequences();
+	bool copy_match();
+	bool copy_raw();
+	bool skip(uint32_t num_bytes, State next);
+	bool error(const char *msg);
+
+	uint32_t available() const { return _in_end - _in; }
+};
@@ -2,27 +2,43 @@
 #include "board_conf.hh"
 
 #include "boot_media_loader.hh"
+#include "boot_profiler.hh"
+#include "crc/crc32.hh"
 #include "delay.h"
 #include "drivers/clocks.hh"
+#include "drivers/generic_timer.hh"
 #include "drivers/ddr/ram_tests.hh"
 #include "drivers/ddr/stm32mp1_ram.h"
 #include "drivers/leds.hh"
+#include "drivers/norflash/qspi_benchmark.hh"
 #include "drivers/pmic.hh"
+#include "drivers/reset_flags.hh"
+#include "drivers/sdmmc_benchmark.hh"
 #include "drivers/uart.hh"
+#include "drivers/uart_dma_console.hh"
+#include "mmu.h"
 #include "print.hh"
 #include "stm32mp157cxx_ca7.h"
 #include "systeminit.h"
 
 void main()
 {
+	GenericTimer::init(Board::HSE_Clock_Hz);
+	BootProfiler::mark("start");
+
 	Board::OrangeLED led;
 
 	auto clockspeed = SystemClocks::init_core_clocks(Board::HSE_Clock_Hz, Board::MPU_MHz, Board::ClockType);
 	security_init();
+	BootProfiler::mark("clocks");
 
 	Uart<Board::ConsoleUART> console(Board::UartRX, Board::UartTX, 115200);
 	print("\n\nMP1-Boot\n\n");
 	print("MPU Clock: ", clockspeed, " Hz\n");
+	BootProfiler::mark("console");
+
+	// The app finds the RCC reset flags cleared, and a copy in the backup SRAM (see README.md)
+	ResetFlags::read_and_clear();
 
 	if constexpr (Board::PMIC::HasSTPMIC) {
 		STPMIC1 pmic{Board::PMIC::I2C_config};
@@ -32,13 +48,43 @@ void main()
 
 		if (!pmic.setup_ddr3_pwr())
 			panic("Could not setup PMIC DDR voltages\n");
+
+		BootProfiler::mark("PMIC");
 	}
 
 	print("Initializing RAM\n");
 	stm32mp1_ddr_setup();
+	BootProfiler::mark("DDR init");
 
 	print("Testing RAM.\n");
 	RamTests::run_all(DRAM_MEM_BASE, stm32mp1_ddr_get_size());
+	BootProfiler::mark("DDR tests");
+
+	// Make DDR (and everything else) cacheable while loading the image
+	mmu_enable(stm32mp1_ddr_get_size());
+
+	if constexpr (Board::RunBenchmarks) {
+		CRC32::benchmark((const uint8_t *)DRAM_MEM_BASE, 1024 * 1024, clockspeed);
+
+		if constexpr (Board::NORFlash::HasNORFlash) {
+			BootNorLoader nor_init; // Inits the QSPI pins and peripheral
+			QSPIBenchmark::run(BootImageDef::NorFlashAppAddr, (uint8_t *)DRAM_MEM_BASE, 256 * 1024, clockspeed);
+		}
+
+		if (BootDetect::read_boot_method() == BootDetect::BOOT_SDCARD) {
+			BootSDLoader sd_init; // Inits the card and picks the bus mode
+			if (!sd_init.has_error())
+				SDMMCBenchmark::run(sd_init.controller(), (uint8_t *)DRAM_MEM_BASE, 1024 * 1024, clockspeed);
+		}
+
+		if (BootDetect::read_boot_method() == BootDetect::BOOT_EMMC) {
+			BootEMMCLoader emmc_init; // Inits the device and picks the bus mode
+			if (!emmc_init.has_error())
+				SDMMCBenchmark::run(emmc_init.controller(), (uint8_t *)DRAM_MEM_BASE, 1024 * 1024, clockspeed);
+		}
+
+		BootProfiler::mark("benchmarks");
+	}
 
 	auto boot_method = BootDetect::read_boot_method();
 	print("Booted from ", BootDetect::bootmethod_string(boot_method).data(), "\n");
@@ -54,11 +100,13 @@ void main()
 			image_type = BootLoader::LoadTarget::SSBL;
 			print("Boot Select pin detected active: Loading alt image...\n");
 		}
+		BootProfiler::mark("boot select");
 	}
 	if (image_type == BootLoader::LoadTarget::App)
 		print("Loading main app image...\n");
 
 	BootMediaLoader loader{boot_method};
+	BootProfiler::mark("media init");
 	bool image_ok = loader.load_image(image_type);
 
 	if (image_ok) {
@@ -68,6 +116,7 @@ void main()
 
 	// Should not reach here, but in case we do, blink LED rapidly
 	print("FAILED!\n");
+	print_flush();
 	constexpr uint32_t dlytime = 50000;
 	while (true) {
 		led.on();
@@ -77,4 +126,6 @@ void main()
 	}
 }
 
-void putchar_s(const char c) { Uart<Board::ConsoleUART>::putchar(c); }
+void putchar_s(const char c) { UartDMAConsole<Board::ConsoleUART>::putchar(c); }
+
+void print_flush() { UartDMAConsole<Board::ConsoleUART>::flush(); }
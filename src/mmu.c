@@ -0,0 +1,133 @@
+#include "mmu.h"
+#include "stm32mp1xx.h"
+
+// One entry per 1MB section, covering the full 4GB. Regions that are not
+// mapped below stay as 0 (fault), which catches wild pointers and keeps the
+// core from speculatively accessing memory that's not there.
+static uint32_t mmu_table[4096] __attribute__((aligned(16384)));
+
+#define SECTION_SIZE (1024 * 1024)
+#define NUM_SECTIONS(size) (((size) + SECTION_SIZE - 1) / SECTION_SIZE)
+
+#define QSPI_WINDOW_SIZE 0x10000000
+
+#define L1_LINE_SIZE 64
+#define L2_LINE_SIZE 32
+
+void mmu_enable(uint32_t ddr_size)
+{
+	mmu_region_attributes_Type region;
+	uint32_t sect_normal;
+	uint32_t sect_device_rw;
+
+	section_normal(sect_normal, region);
+	section_device_rw(sect_device_rw, region);
+
+	// SYSRAM (code, data, stacks)
+	MMU_TTSection(mmu_table, SYSRAM_BASE, 1, sect_normal);
+
+	// The QSPI NOR Flash window is mapped by mmu_map_qspi(), once the flash size is known
+
+	// Peripherals (including BKPSRAM and the DDR controller/PHY)
+	MMU_TTSection(mmu_table, PERIPH_BASE, NUM_SECTIONS(0x20000000), sect_device_rw);
+
+	// GIC
+	MMU_TTSection(mmu_table, GIC_BASE & 0xFFF00000, 1, sect_device_rw);
+
+	// DDR: only the installed size
+	MMU_TTSection(mmu_table, DRAM_MEM_BASE, NUM_SECTIONS(ddr_size), sect_normal);
+
+	// The table was written with the MMU off, so it's already in memory
+	__DSB();
+
+	__set_TTBR0((uint32_t)mmu_table);
+	__ISB();
+
+	// Domain 0: Client (check permissions in the descriptors)
+	__set_DACR(1);
+	__ISB();
+
+	MMU_InvalidateTLB();
+	MMU_Enable();
+}
+
+void mmu_map_qspi(uint32_t qspi_size)
+{
+	mmu_region_attributes_Type region;
+	uint32_t sect_normal_ro;
+	section_normal_ro(sect_normal_ro, region);
+
+	// Read-only, not executable. Only the part that's backed by the flash is mapped,
+	// the rest of the window faults.
+	uint32_t num_sections = NUM_SECTIONS(qspi_size);
+	if (num_sections > NUM_SECTIONS(QSPI_WINDOW_SIZE))
+		num_sections = NUM_SECTIONS(QSPI_WINDOW_SIZE);
+	MMU_TTSection(mmu_table, QSPI_MEM_BASE, NUM_SECTIONS(QSPI_WINDOW_SIZE), 0); // Fault
+	MMU_TTSection(mmu_table, QSPI_MEM_BASE, num_sections, sect_normal_ro);
+
+	// The table walks don't look in the caches
+	dcache_clean_range((uint32_t)&mmu_table[QSPI_MEM_BASE / SECTION_SIZE], NUM_SECTIONS(QSPI_WINDOW_SIZE) * 4);
+	MMU_InvalidateTLB();
+}
+
+void mmu_disable(void)
+{
+	L1C_CleanInvalidateDCacheAll();
+#if (__L2C_PRESENT == 1)
+	L2C_CleanInvAllByWay();
+#endif
+
+	MMU_Disable();
+	MMU_InvalidateTLB();
+
+	L1C_InvalidateICacheAll();
+	L1C_InvalidateBTAC();
+}
+
+void dcache_clean_invalidate_range(uint32_t addr, uint32_t size)
+{
+	uint32_t start = addr & ~(L1_LINE_SIZE - 1);
+	uint32_t end = addr + size;
+
+	// Inner to outer: clean L1 first so L2 receives the dirty lines
+	for (uint32_t a = start; a < end; a += L1_LINE_SIZE)
+		L1C_CleanInvalidateDCacheMVA((void *)a);
+	__DSB();
+
+#if (__L2C_PRESENT == 1)
+	for (uint32_t a = addr & ~(L2_LINE_SIZE - 1); a < end; a += L2_LINE_SIZE)
+		L2C_310->CLEAN_INV_LINE_PA = a;
+	L2C_Sync();
+#endif
+}
+
+void dcache_clean_range(uint32_t addr, uint32_t size)
+{
+	uint32_t end = addr + size;
+
+	for (uint32_t a = addr & ~(L1_LINE_SIZE - 1); a < end; a += L1_LINE_SIZE)
+		L1C_CleanDCacheMVA((void *)a);
+	__DSB();
+
+#if (__L2C_PRESENT == 1)
+	for (uint32_t a = addr & ~(L2_LINE_SIZE - 1); a < end; a += L2_LINE_SIZE)
+		L2C_310->CLEAN_LINE_PA = a;
+	L2C_Sync();
+#endif
+}
+
+void dcache_invalidate_range(uint32_t addr, uint32_t size)
+{
+	uint32_t end = addr + size;
+
+	// Outer to inner: so L1 can't re-fill from stale L2 lines
+#if (__L2C_PRESENT == 1)
+	for (uint32_t a = addr & ~(L2_LINE_SIZE - 1); a < end; a += L2_LINE_SIZE)
+		L2C_310->INV_LINE_PA = a;
+	L2C_Sync();
+#endif
+
+	for (uint32_t a = addr & ~(L1_LINE_SIZE - 1); a < end; a += L1_LINE_SIZE)
+		L1C_InvalidateDCacheMVA((void *)a);
+	__DSB();
+}
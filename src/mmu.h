@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Builds an identity-mapped section table and enables the MMU, so that SYSRAM
+// and DDR are cacheable. Call after DDR is initialized.
+void mmu_enable(uint32_t ddr_size);
+
+// Maps the first qspi_size bytes of the QSPI memory-mapped window (cacheable, read-only).
+// Call once the NOR Flash size is known (size of both chips, in dual-flash mode).
+void mmu_map_qspi(uint32_t qspi_size);
+
+// Cleans and invalidates all caches and disables the MMU.
+// Call this before jumping to an image.
+void mmu_disable(void);
+
+// Cache maintenance for buffers shared with DMA (SDMMC IDMA, MDMA...)
+// Clean+invalidate a range before a peripheral writes to it,
+// and invalidate it again after the transfer, before the CPU reads it.
+void dcache_clean_invalidate_range(uint32_t addr, uint32_t size);
+void dcache_invalidate_range(uint32_t addr, uint32_t size);
+
+// Write back a range the CPU wrote, before a peripheral reads it
+void dcache_clean_range(uint32_t addr, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,75 +1,79 @@
 #include "print.hh"
 
-// putchar_s(const char) Must be defined in the applicaton code somewhere
-void putchar_s(const char c);
-
-void printone(const unsigned char *str)
+static void print_padding(uint32_t count, char c)
 {
-	while (*str)
-		putchar_s(*str++);
+	while (count--)
+		putchar_s(c);
 }
 
-void printone(const char *str)
+void print_string(const char *str, const FormatSpec &spec)
 {
-	while (*str)
-		putchar_s(*str++);
+	uint32_t len = 0;
+	while (str[len])
+		len++;
+
+	uint32_t padding = spec.width > len ? spec.width - len : 0;
+	if (!spec.left_align)
+		print_padding(padding, ' ');
+	print_text(str, len);
+	if (spec.left_align)
+		print_padding(padding, ' ');
 }
 
-void printone(Hex hex)
+// 64-bit division would need libgcc, so divide 16 bits at a time:
+// each step fits in 32 bits
+static uint32_t divmod10(uint64_t &value)
 {
-	auto value = hex.x;
-
-	if (!value) {
-		printone("0");
-		return;
-	}
-	/// TODO: read left to right, not right to left, to avoid flipping digits
-	constexpr int MAX_DIGITS = 8;
-	char buf[MAX_DIGITS + 1];
-	int len = 0;
-	do {
-		const char digit = (char)(value & 0xF);
-		buf[len++] = digit < 10 ? '0' + digit : 'A' + digit - 10;
-		value >>= 4;
-	} while (value && (len < MAX_DIGITS));
-	buf[len] = '\0';
+	uint32_t hi = value >> 32;
+	uint32_t lo = value;
 
-	for (int i = 0; i < len / 2; i++) {
-		auto tmp = buf[i];
-		buf[i] = buf[len - i - 1];
-		buf[len - i - 1] = tmp;
-	}
+	uint32_t q_hi = hi / 10;
+	uint32_t mid = ((hi % 10) << 16) | (lo >> 16);
+	uint32_t q_mid = mid / 10;
+	uint32_t low = ((mid % 10) << 16) | (lo & 0xFFFF);
+	uint32_t q_low = low / 10;
 
-	printone(buf);
+	value = (static_cast<uint64_t>(q_hi) << 32) | (q_mid << 16) | q_low;
+	return low % 10;
 }
 
-void printone(int value)
+void print_number(uint64_t magnitude, bool negative, uint32_t base, bool uppercase, const FormatSpec &spec)
 {
-	if (!value) {
-		printone("0");
-		return;
-	}
+	// Digits are written from the end of the buffer, least significant first
+	constexpr uint32_t MaxDigits = 20; // 2^64 in decimal
+	char buf[MaxDigits];
+	uint32_t start = MaxDigits;
 
-	if (value < 0) {
-		printone("-");
-		value = -value;
+	const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+	if (base == 16) {
+		do {
+			buf[--start] = digits[magnitude & 0xF];
+			magnitude >>= 4;
+		} while (magnitude);
+	} else if (magnitude >> 32) {
+		do {
+			buf[--start] = digits[divmod10(magnitude)];
+		} while (magnitude);
+	} else {
+		uint32_t value = magnitude;
+		do {
+			buf[--start] = digits[value % 10];
+			value /= 10;
+		} while (value);
 	}
 
-	constexpr int MAX_DIGITS = 10;
-	char buf[MAX_DIGITS + 1];
-	int len = 0;
-	do {
-		const char digit = (char)(value % 10);
-		buf[len++] = '0' + digit;
-		value /= 10;
-	} while (value && (len < MAX_DIGITS));
-	buf[len] = '\0';
+	uint32_t len = MaxDigits - start + (negative ? 1 : 0);
+	uint32_t padding = spec.width > len ? spec.width - len : 0;
 
-	for (int i = 0; i < len / 2; i++) {
-		auto tmp = buf[i];
-		buf[i] = buf[len - i - 1];
-		buf[len - i - 1] = tmp;
-	}
+	if (!spec.left_align && !spec.zero_pad)
+		print_padding(padding, ' ');
+	if (negative)
+		putchar_s('-');
+	if (!spec.left_align && spec.zero_pad)
+		print_padding(padding, '0');
+
+	print_text(&buf[start], MaxDigits - start);
 
-	printone(buf);
+	if (spec.left_align)
+		print_padding(padding, ' ');
 }
@@ -1,16 +1,202 @@
 #pragma once
+#include <cstdint>
+#include <type_traits>
 
 struct Hex {
 	unsigned x;
 };
 
-void printone(const unsigned char *str);
-void printone(const char *str);
-void printone(int value);
-void printone(Hex value);
+// putchar_s(const char) Must be defined in the applicaton code somewhere
+void putchar_s(const char c);
 
-template<typename... Types>
-void print(Types... args)
+// Waits until everything printed so far has been sent (output may be buffered).
+// Must be defined in the application code, like putchar_s()
+void print_flush();
+
+// How to print one argument, and where the literal text before it is in the format string
+struct FormatSpec {
+	uint16_t text_start = 0;
+	uint16_t text_len = 0;
+	char conversion = 0; // d, i, u, x, X, s, c, or 0 to print it as if concatenated
+	uint8_t width = 0;
+	bool zero_pad = false;
+	bool left_align = false;
+};
+
+enum class PrintArgKind { Unsupported, String, Signed, Unsigned, Hex };
+
+template<typename T>
+consteval PrintArgKind print_arg_kind()
+{
+	using U = std::remove_cvref_t<T>;
+	if constexpr (std::is_same_v<U, Hex>)
+		return PrintArgKind::Hex;
+	else if constexpr (std::is_pointer_v<U>)
+		return sizeof(std::remove_pointer_t<U>) == 1 ? PrintArgKind::String : PrintArgKind::Unsupported;
+	else if constexpr (std::is_enum_v<U>)
+		return print_arg_kind<std::underlying_type_t<U>>();
+	else if constexpr (std::is_integral_v<U>)
+		return std::is_signed_v<U> ? PrintArgKind::Signed : PrintArgKind::Unsigned;
+	else
+		return PrintArgKind::Unsupported;
+}
+
+// Not constexpr: calling it while parsing a format string makes the compiler
+// reject the format string, with this function in the error message.
+void format_string_error(const char *reason);
+
+// A format string, parsed and checked against the argument types at compile time.
+// If it has no conversions, the arguments are printed after it, one after the other.
+// Otherwise, each argument needs a conversion: %[-][0][width][length]d|i|u|x|X|s|c
+// Length modifiers (l, ll, h, hh, z) are accepted and ignored: each value is printed
+// at the size of its type. %% is not supported.
+template<typename... Args>
+struct FormatString {
+	static constexpr uint32_t NumArgs = sizeof...(Args);
+
+	const char *str;
+	FormatSpec specs[NumArgs + 1]{}; // specs[NumArgs] is the text after the last argument
+
+	consteval FormatString(const char *s)
+		: str{s}
+	{
+		constexpr PrintArgKind kinds[NumArgs + 1] = {print_arg_kind<Args>()..., PrintArgKind::Unsupported};
+		for (uint32_t arg = 0; arg < NumArgs; arg++) {
+			if (kinds[arg] == PrintArgKind::Unsupported)
+				format_string_error("argument type can't be printed");
+		}
+
+		uint32_t len = 0;
+		bool has_conversions = false;
+		while (s[len]) {
+			if (s[len] == '%')
+				has_conversions = true;
+			len++;
+		}
+
+		if (!has_conversions) {
+			specs[0].text_len = len;
+			return;
+		}
+
+		uint32_t pos = 0;
+		for (uint32_t arg = 0; arg <= NumArgs; arg++) {
+			auto &spec = specs[arg];
+			spec.text_start = pos;
+			while (s[pos] && s[pos] != '%')
+				pos++;
+			spec.text_len = pos - spec.text_start;
+
+			if (arg == NumArgs) {
+				if (s[pos])
+					format_string_error("more conversions than arguments");
+				break;
+			}
+			if (!s[pos])
+				format_string_error("fewer conversions than arguments");
+			pos++;
+
+			for (;; pos++) {
+				if (s[pos] == '-')
+					spec.left_align = true;
+				else if (s[pos] == '0')
+					spec.zero_pad = true;
+				else
+					break;
+			}
+			while (s[pos] >= '0' && s[pos] <= '9')
+				spec.width = spec.width * 10 + (s[pos++] - '0');
+			while (s[pos] == 'l' || s[pos] == 'h' || s[pos] == 'z')
+				pos++;
+
+			spec.conversion = s[pos];
+			switch (spec.conversion) {
+				case 's':
+					if (kinds[arg] != PrintArgKind::String)
+						format_string_error("%s needs a string");
+					break;
+				case 'd':
+				case 'i':
+				case 'u':
+				case 'x':
+				case 'X':
+				case 'c':
+					if (kinds[arg] == PrintArgKind::String)
+						format_string_error("integer conversion given a string");
+					break;
+				default:
+					format_string_error("unsupported conversion");
+			}
+			pos++;
+		}
+	}
+};
+
+template<typename T>
+inline constexpr bool is_format_string = false;
+template<typename... Args>
+inline constexpr bool is_format_string<FormatString<Args...>> = true;
+
+// A first argument that's not a string literal is printed like the others,
+// without being parsed as a format string
+template<typename T>
+concept PlainFirstArg = !std::is_array_v<std::remove_reference_t<T>> && !is_format_string<std::remove_cvref_t<T>>;
+
+// Output primitives (print.cc)
+void print_string(const char *str, const FormatSpec &spec);
+void print_number(uint64_t magnitude, bool negative, uint32_t base, bool uppercase, const FormatSpec &spec);
+
+inline void print_text(const char *str, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+		putchar_s(str[i]);
+}
+
+template<typename T>
+void print_arg(const FormatSpec &spec, T arg)
+{
+	constexpr auto kind = print_arg_kind<T>();
+	static_assert(kind != PrintArgKind::Unsupported, "Argument type can't be printed");
+
+	if constexpr (kind == PrintArgKind::String) {
+		print_string(reinterpret_cast<const char *>(arg), spec);
+	} else {
+		uint64_t value;
+		bool negative = false;
+		if constexpr (kind == PrintArgKind::Hex) {
+			value = arg.x;
+		} else if constexpr (kind == PrintArgKind::Signed) {
+			negative = arg < 0;
+			value = negative ? 0 - static_cast<uint64_t>(arg) : static_cast<uint64_t>(arg);
+		} else {
+			value = static_cast<uint64_t>(arg);
+		}
+
+		if (spec.conversion == 'c') {
+			putchar_s(static_cast<char>(value));
+			return;
+		}
+
+		// Hex{} prints in uppercase hex unless the conversion says otherwise
+		const bool hex = spec.conversion == 'x' || spec.conversion == 'X' ||
+						 (kind == PrintArgKind::Hex && spec.conversion == 0);
+		print_number(value, negative, hex ? 16 : 10, spec.conversion != 'x', spec);
+	}
+}
+
+// The format string is parsed at compile time, so this only prints the
+// pieces of text and the arguments, in order.
+template<typename... Args>
+void print(FormatString<std::type_identity_t<Args>...> fmt, Args... args)
+{
+	uint32_t i = 0;
+	((print_text(fmt.str + fmt.specs[i].text_start, fmt.specs[i].text_len), print_arg(fmt.specs[i], args), i++), ...);
+	print_text(fmt.str + fmt.specs[i].text_start, fmt.specs[i].text_len);
+}
+
+template<PlainFirstArg First, typename... Args>
+void print(First &&first, Args... args)
 {
-	(printone(args), ...);
+	print_arg(FormatSpec{}, first);
+	(print_arg(FormatSpec{}, args), ...);
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include "binary_log.hh"
 #include "print.hh"
 
 /////////////////////////////////////////////
@@ -6,36 +7,91 @@
 constexpr bool PrintDebugMessages = false;
 constexpr bool PrintLogMessages = false;
 constexpr bool PrintErrorMessages = true;
+
+// Record debug and log messages in BinaryLog::region instead of printing them.
+// Decode them on the host with binlog_decode.py. Error messages are always printed.
+constexpr bool BinaryLogMessages = false;
 /////////////////////////////////////////////
 
+// Each of these takes a format string and its arguments (see FormatString in print.hh),
+// or a list of things to print one after the other.
+// When a type of message is turned off, the call compiles to nothing
+// (the format string is still checked).
+
 template<typename... Types>
-static inline void debug(Types... args)
+static inline void debug(FormatString<std::type_identity_t<Types>...> fmt, Types... args)
+{
+	if constexpr (PrintDebugMessages && BinaryLogMessages)
+		BinaryLog::record(fmt.str, args...);
+	else if constexpr (PrintDebugMessages)
+		print(fmt, args...);
+}
+
+template<PlainFirstArg First, typename... Types>
+static inline void debug(First &&first, Types... args)
 {
-	if constexpr (PrintDebugMessages)
-		print(args...);
+	if constexpr (PrintDebugMessages && BinaryLogMessages)
+		BinaryLog::record(first, args...);
+	else if constexpr (PrintDebugMessages)
+		print(first, args...);
 }
 
 template<typename... Types>
-static inline void log(Types... args)
+static inline void log(FormatString<std::type_identity_t<Types>...> fmt, Types... args)
 {
-	if constexpr (PrintLogMessages)
-		print(args...);
+	if constexpr (PrintLogMessages && BinaryLogMessages)
+		BinaryLog::record(fmt.str, args...);
+	else if constexpr (PrintLogMessages)
+		print(fmt, args...);
+}
+
+template<PlainFirstArg First, typename... Types>
+static inline void log(First &&first, Types... args)
+{
+	if constexpr (PrintLogMessages && BinaryLogMessages)
+		BinaryLog::record(first, args...);
+	else if constexpr (PrintLogMessages)
+		print(first, args...);
 }
 
 template<typename... Types>
-static inline void pr_err(Types... args)
+static inline void pr_err(FormatString<std::type_identity_t<Types>...> fmt, Types... args)
 {
 	if constexpr (PrintErrorMessages)
-		print(args...);
+		print(fmt, args...);
 }
 
-template<typename... Types>
-static inline void panic(Types... args)
+template<PlainFirstArg First, typename... Types>
+static inline void pr_err(First &&first, Types... args)
 {
 	if constexpr (PrintErrorMessages)
-		print(args...);
+		print(first, args...);
+}
 
+[[noreturn]] static inline void hang()
+{
 	volatile bool ForceCompilerToKeepInfLoop = true;
 	while (ForceCompilerToKeepInfLoop) {
 	}
+	__builtin_unreachable();
+}
+
+template<typename... Types>
+[[noreturn]] static inline void panic(FormatString<std::type_identity_t<Types>...> fmt, Types... args)
+{
+	if constexpr (PrintErrorMessages) {
+		print(fmt, args...);
+		print_flush();
+	}
+	hang();
+}
+
+template<PlainFirstArg First, typename... Types>
+[[noreturn]] static inline void panic(First &&first, Types... args)
+{
+	if constexpr (PrintErrorMessages) {
+		print(first, args...);
+		print_flush();
+	}
+	hang();
 }
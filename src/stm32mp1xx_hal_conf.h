@@ -61,7 +61,7 @@ extern "C" {
 //#define HAL_RNG_MODULE_ENABLED
 //#define HAL_RTC_MODULE_ENABLED
 //#define HAL_SAI_MODULE_ENABLED
-#define HAL_SD_MODULE_ENABLED
+//#define HAL_SD_MODULE_ENABLED
 //#define HAL_SMARTCARD_MODULE_ENABLED
 //#define HAL_SMBUS_MODULE_ENABLED
 //#define HAL_SPDIFRX_MODULE_ENABLED
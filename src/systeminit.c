@@ -1,3 +1,4 @@
+#include "delay.h"
 #include "stm32mp1xx.h"
 
 uint32_t SystemCoreClock = 24000000;
@@ -72,3 +73,26 @@ void security_init()
 	// Enable Filter 0 and 1
 	TZC->GATE_KEEPER = TZC->GATE_KEEPER | (1 << 0) | (1 << 1);
 }
+
+// Time base for the HAL (HAL_Delay() and HAL timeouts): milliseconds counted from
+// the generic timer, instead of a SysTick interrupt incrementing uwTick.
+// It's kept as a running count so that it only needs 32-bit math, which means it
+// must be called at least once every 178 seconds (24MHz counter) to stay correct.
+uint32_t HAL_GetTick(void)
+{
+	static uint32_t last_ticks;
+	static uint32_t ticks_left;
+	static uint32_t ms;
+
+	const uint32_t ticks_per_ms = timer_ticks_per_us() * 1000;
+	if (!ticks_per_ms)
+		return ms;
+
+	uint32_t now = timer_ticks();
+	ticks_left += now - last_ticks;
+	last_ticks = now;
+
+	ms += ticks_left / ticks_per_ms;
+	ticks_left %= ticks_per_ms;
+	return ms;
+}
@@ -6,9 +6,8 @@
 #ifndef _LINUX_IOPOLL_H
 #define _LINUX_IOPOLL_H
 
-// Changed by DG:
-#define timer_get_us() (0)
-#define time_after(a, b) (0)
+// Changed by DG: timed with the deadlines in delay.h
+#include "delay.h"
 // #include <linux/errno.h>
 // #include <linux/io.h>
 // #include <time.h>
@@ -29,12 +28,12 @@
  */
 #define readx_poll_timeout(op, addr, val, cond, timeout_us)                                                            \
 	({                                                                                                                 \
-		unsigned long timeout = timer_get_us() + timeout_us;                                                           \
+		deadline_t deadline = deadline_us(timeout_us);                                                                 \
 		for (;;) {                                                                                                     \
 			(val) = op(addr);                                                                                          \
 			if (cond)                                                                                                  \
 				break;                                                                                                 \
-			if (timeout_us && time_after(timer_get_us(), timeout)) {                                                   \
+			if (timeout_us && deadline_passed(deadline)) {                                                             \
 				(val) = op(addr);                                                                                      \
 				break;                                                                                                 \
 			}                                                                                                          \